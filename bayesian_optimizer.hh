@@ -0,0 +1,337 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Bayesian optimization for objectives that are too expensive for the
+// perturbation-based optimizers, e.g. image sets where each evaluation takes
+// seconds. Only practical for up to bayesian_max_free_axes free axes and a few
+// hundred evaluations.
+#ifndef KDOP_BAYESIAN_OPTIMIZER_HH
+#define KDOP_BAYESIAN_OPTIMIZER_HH
+#include "optimizer.hh"
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+using namespace glm;
+
+// Gaussian process over axis sets, i.e. over a product of spheres. Only the
+// axes after 'locked_axes' matter. An axis and its negation give the same
+// k-DOP, so the distance between two axes is 1 - |dot|, which is about half
+// the squared angle between them for nearby axes.
+class axis_gaussian_process
+{
+public:
+    axis_gaussian_process(int locked_axes, double length_scale, double noise)
+    :   locked_axes(locked_axes), length_scale(length_scale), noise(noise)
+    {
+    }
+
+    double kernel(const std::vector<vec3>& a, const std::vector<vec3>& b) const
+    {
+        double d = 0;
+        for(size_t i = locked_axes; i < a.size(); ++i)
+            d += 1.0 - fabs(dot(a[i], b[i]));
+        return exp(-d / (length_scale * length_scale));
+    }
+
+    // Targets should be normalized to zero mean and unit variance. Returns
+    // false if the kernel matrix isn't positive definite.
+    bool fit(
+        const std::vector<std::vector<vec3>>& points,
+        const std::vector<double>& targets
+    ){
+        this->points = &points;
+        size_t n = targets.size();
+        chol.assign(n * n, 0.0);
+        for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j <= i; ++j)
+            chol[i*n+j] = kernel(points[i], points[j]) + (i == j ? noise : 0.0);
+
+        // In-place Cholesky decomposition, lower triangle.
+        for(size_t j = 0; j < n; ++j)
+        {
+            double sum = chol[j*n+j];
+            for(size_t k = 0; k < j; ++k)
+                sum -= chol[j*n+k] * chol[j*n+k];
+            if(sum <= 0) return false;
+            chol[j*n+j] = sqrt(sum);
+            for(size_t i = j+1; i < n; ++i)
+            {
+                double s = chol[i*n+j];
+                for(size_t k = 0; k < j; ++k)
+                    s -= chol[i*n+k] * chol[j*n+k];
+                chol[i*n+j] = s / chol[j*n+j];
+            }
+        }
+
+        alpha = targets;
+        solve_lower(alpha);
+        log_det = 0;
+        for(size_t i = 0; i < n; ++i)
+            log_det += 2.0 * log(chol[i*n+i]);
+        fit_energy = 0;
+        for(double a: alpha)
+            fit_energy += a * a;
+        // Turn L^-1 y into K^-1 y.
+        solve_upper(alpha);
+        return true;
+    }
+
+    double log_marginal_likelihood() const
+    {
+        return -0.5 * fit_energy - 0.5 * log_det;
+    }
+
+    void predict(const std::vector<vec3>& x, double& mean, double& variance) const
+    {
+        size_t n = alpha.size();
+        std::vector<double> k(n);
+        for(size_t i = 0; i < n; ++i)
+            k[i] = kernel(x, (*points)[i]);
+        mean = 0;
+        for(size_t i = 0; i < n; ++i)
+            mean += k[i] * alpha[i];
+        solve_lower(k);
+        variance = 1.0 + noise;
+        for(double v: k)
+            variance -= v * v;
+        variance = std::max(variance, 1e-12);
+    }
+
+private:
+    void solve_lower(std::vector<double>& b) const
+    {
+        size_t n = b.size();
+        for(size_t i = 0; i < n; ++i)
+        {
+            for(size_t k = 0; k < i; ++k)
+                b[i] -= chol[i*n+k] * b[k];
+            b[i] /= chol[i*n+i];
+        }
+    }
+
+    void solve_upper(std::vector<double>& b) const
+    {
+        size_t n = b.size();
+        for(size_t i = n; i-- > 0;)
+        {
+            for(size_t k = i+1; k < n; ++k)
+                b[i] -= chol[k*n+i] * b[k];
+            b[i] /= chol[i*n+i];
+        }
+    }
+
+    int locked_axes;
+    double length_scale;
+    double noise;
+    const std::vector<std::vector<vec3>>* points = nullptr;
+    std::vector<double> chol;
+    std::vector<double> alpha;
+    double log_det = 0;
+    double fit_energy = 0;
+};
+
+// Expected improvement below 'best' for a normally distributed prediction.
+inline double expected_improvement(double mean, double variance, double best)
+{
+    double sigma = sqrt(variance);
+    double improvement = best - mean;
+    double z = improvement / sigma;
+    double cdf = 0.5 * erfc(-z / sqrt(2.0));
+    double pdf = exp(-0.5 * z * z) * 0.3989422804014327; // 1/sqrt(2pi)
+    return improvement * cdf + sigma * pdf;
+}
+
+// With more free axes than this, a few hundred evaluations aren't enough for
+// the surrogate to learn the objective, and the other modes do better.
+constexpr int bayesian_max_free_axes = 6;
+
+struct bayesian_params
+{
+    // Optimization ends after this many evaluations. Fitting the surrogate
+    // is cubic in the number of evaluations, so this should stay in the
+    // hundreds.
+    size_t max_evaluations = 300;
+    // Random axis sets evaluated before the surrogate is used.
+    size_t initial_samples = 10;
+    // Proposals per surrogate fit. After each one, the surrogate is refit with
+    // a made-up best score at that point ("constant liar"), which pushes the
+    // next proposal elsewhere.
+    size_t batch_size = 4;
+    // Number of candidates scored by expected improvement per proposal.
+    // Half are uniformly random, half are perturbations of the best axes.
+    size_t candidate_count = 1000;
+    uint seed = 0;
+    // 0 = silent, 1 = print scores, 2 = print scores and axes.
+    int verbosity = 0;
+};
+
+// Fits a Gaussian process to the logarithm of the scores, as k-DOP volumes
+// span several orders of magnitude, and proposes the axes with the highest
+// expected improvement. The length scale is re-selected by marginal
+// likelihood on every fit. Costs must be positive.
+inline optimizer_result optimize_bayesian(
+    const std::vector<vec3>& initial_axes,
+    int locked_axes,
+    const axis_objective& objective,
+    const bayesian_params& params,
+    const optimizer_budget& budget = {}
+){
+    optimizer_result result;
+    result.best_axes = initial_axes;
+    optimizer_tracker tracker(result, budget, params.verbosity);
+    uint seed = params.seed;
+
+    int free_axes = int(initial_axes.size()) - locked_axes;
+    if(free_axes > bayesian_max_free_axes)
+        fprintf(
+            stderr, "Warning: Bayesian optimization of %d free axes, it's only "
+            "effective for up to %d\n", free_axes, bayesian_max_free_axes
+        );
+
+    std::vector<std::vector<vec3>> points;
+    std::vector<double> log_scores;
+    auto observe = [&](const std::vector<vec3>& axes)
+    {
+        float score = tracker.evaluate(objective, axes);
+        if(score > 0 && std::isfinite(score))
+        {
+            points.push_back(axes);
+            log_scores.push_back(log(score));
+        }
+    };
+    auto done = [&]()
+    {
+        return tracker.exhausted() || result.evaluations >= params.max_evaluations;
+    };
+
+    auto random_axes = [&]()
+    {
+        std::vector<vec3> axes = initial_axes;
+        for(size_t i = locked_axes; i < axes.size(); ++i)
+            axes[i] = sample_sphere(seed);
+        return axes;
+    };
+
+    if(initial_axes_valid(initial_axes, locked_axes))
+        observe(initial_axes);
+    while(points.size() < params.initial_samples && !done())
+        observe(random_axes());
+
+    const double length_scales[] = {0.05, 0.1, 0.2, 0.4, 0.8};
+    const double noise = 1e-4;
+    const float perturbation_steps[] = {0.3f, 0.1f, 0.03f, 0.01f};
+    while(!done())
+    {
+        if(tracker.refresh(objective))
+        {
+            // Old scores aren't comparable anymore; start over from the
+            // re-scored best.
+            points.clear();
+            log_scores.clear();
+            if(result.best_score > 0 && std::isfinite(result.best_score))
+            {
+                points.push_back(result.best_axes);
+                log_scores.push_back(log(result.best_score));
+            }
+            while(points.size() < params.initial_samples && !done())
+                observe(random_axes());
+            continue;
+        }
+
+        if(points.size() < 2)
+        {
+            observe(random_axes());
+            continue;
+        }
+
+        // Normalize, so that the kernel's unit variance fits the data.
+        size_t n = log_scores.size();
+        double mean = std::accumulate(log_scores.begin(), log_scores.end(), 0.0) / n;
+        double var = 0;
+        for(double s: log_scores)
+            var += (s - mean) * (s - mean);
+        double scale = var > 0 ? sqrt(var / n) : 1.0;
+        std::vector<double> targets(n);
+        for(size_t i = 0; i < n; ++i)
+            targets[i] = (log_scores[i] - mean) / scale;
+
+        double best_likelihood = -INFINITY;
+        double length_scale = length_scales[0];
+        for(double l: length_scales)
+        {
+            axis_gaussian_process gp(locked_axes, l, noise);
+            if(!gp.fit(points, targets)) continue;
+            double likelihood = gp.log_marginal_likelihood();
+            if(likelihood > best_likelihood)
+            {
+                best_likelihood = likelihood;
+                length_scale = l;
+            }
+        }
+
+        std::vector<std::vector<vec3>> batch_points = points;
+        std::vector<double> batch_targets = targets;
+        double best_target = *std::min_element(targets.begin(), targets.end());
+        std::vector<std::vector<vec3>> proposals;
+        for(size_t b = 0; b < params.batch_size; ++b)
+        {
+            axis_gaussian_process gp(locked_axes, length_scale, noise);
+            if(!gp.fit(batch_points, batch_targets))
+                break;
+
+            std::vector<vec3> best_candidate;
+            double best_ei = -1;
+            for(size_t c = 0; c < params.candidate_count; ++c)
+            {
+                std::vector<vec3> candidate;
+                if(c % 2 == 0) candidate = random_axes();
+                else candidate = perturb_axes(
+                    result.best_axes, locked_axes,
+                    perturbation_steps[(c/2) % std::size(perturbation_steps)],
+                    seed
+                );
+                double m, v;
+                gp.predict(candidate, m, v);
+                double ei = expected_improvement(m, v, best_target);
+                if(ei > best_ei)
+                {
+                    best_ei = ei;
+                    best_candidate = std::move(candidate);
+                }
+            }
+            proposals.push_back(best_candidate);
+            batch_points.push_back(best_candidate);
+            batch_targets.push_back(best_target);
+        }
+
+        // The objectives parallelize internally, so the batch is evaluated in
+        // order.
+        if(proposals.size() == 0)
+            proposals.push_back(random_axes());
+        for(const std::vector<vec3>& axes: proposals)
+        {
+            if(done()) break;
+            observe(axes);
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,210 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+#include <glm/glm.hpp>
+#include "kdop_clipping.hh"
+#include "image_cost.hh"
+#include "test_images.hh"
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <clocale>
+
+using namespace glm;
+
+// Compares kdop_clipping() in full and half precision for a number of axis
+// sets. The fp32 result is used as the reference for the fp16 error.
+
+struct axis_set
+{
+    std::string name;
+    std::vector<vec3> axes;
+};
+
+// Reads axes in the format that the optimizers print, i.e. one
+// "vec3(x, y, z)," per line. Other lines are ignored.
+bool load_axis_set(const char* path, axis_set& set)
+{
+    FILE* f = fopen(path, "r");
+    if(!f) return false;
+
+    set.name = path;
+    set.axes.clear();
+    char line[256];
+    while(fgets(line, sizeof(line), f))
+    {
+        const char* start = strstr(line, "vec3(");
+        vec3 axis;
+        if(start && sscanf(start + 5, "%f , %f , %f", &axis.x, &axis.y, &axis.z) == 3)
+            set.axes.push_back(normalize(axis));
+    }
+    fclose(f);
+    return set.axes.size() != 0 && set.axes.size() <= 32;
+}
+
+std::vector<axis_set> get_default_axis_sets()
+{
+    return {
+        {"aabb", {vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)}},
+        // Default set of kdop_clipping.glsl
+        {"paper-32dop", {
+            vec3(1, 0, 0),
+            vec3(0, 1, 0),
+            vec3(0, 0, 1),
+            vec3(0.820081, 0.456727, -0.344773),
+            vec3(0.540295, 0.829202, 0.143195),
+            vec3(0.255800, 0.841084, -0.476597),
+            vec3(-0.406935, -0.389062, 0.826459),
+            vec3(-0.826708, -0.382923, -0.412219),
+            vec3(0.260942, -0.577482, 0.773578),
+            vec3(0.254398, 0.637821, 0.726957),
+            vec3(0.310900, -0.728083, -0.610930),
+            vec3(0.798513, -0.556827, -0.228738),
+            vec3(0.673383, -0.163602, -0.720964),
+            vec3(-0.813922, 0.369658, -0.448201),
+            vec3(0.477650, -0.853722, 0.207384),
+            vec3(-0.554854, -0.041550, -0.830910)
+        }}
+    };
+}
+
+struct clipping_case
+{
+    vec3 cur_color;
+    vec3 prev_color;
+    const vec3* colors;
+};
+
+template<typename T>
+double time_clipping(
+    const std::vector<clipping_case>& cases,
+    const axis_set& set,
+    std::vector<vec3>& results,
+    std::vector<bool>& hits
+){
+    results.resize(cases.size());
+    hits.resize(cases.size());
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < cases.size(); ++i)
+    {
+        const clipping_case& c = cases[i];
+        bool hit = false;
+        results[i] = kdop_clipping<T>(
+            c.cur_color, c.prev_color, c.colors, 9,
+            set.axes.data(), set.axes.size(), &hit
+        );
+        hits[i] = hit;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+    {
+        printf("Usage: %s [axis-set-files...]\n", argv[0]);
+        printf("Axis set files contain one vec3(x, y, z) per line, as printed by the optimizers.\n");
+        return 1;
+    }
+
+    // Make atof / sscanf behave predictably
+    setlocale(LC_ALL, "C");
+
+    std::vector<axis_set> sets = get_default_axis_sets();
+    for(int i = 1; i < argc; ++i)
+    {
+        axis_set set;
+        if(!load_axis_set(argv[i], set))
+        {
+            fprintf(stderr, "Failed to read 1-32 axes from %s\n", argv[i]);
+            return 1;
+        }
+        sets.push_back(std::move(set));
+    }
+
+    // History colors come from elsewhere in the image, like they would after
+    // a disocclusion, so that most of them actually get clipped.
+    const int size = 256;
+    const size_t samples_per_image = 100000;
+    neighborhood_dataset dataset;
+    for(test_image kind: {test_image::SHAPES, test_image::NOISE, test_image::STRIPES})
+    {
+        std::vector<uint8_t> image = generate_test_image(kind, size, size, 1234 + int(kind));
+        sample_neighborhoods(dataset, size, size, image.data(), int(kind) * samples_per_image, samples_per_image);
+    }
+    std::vector<clipping_case> cases(dataset.size());
+    uint seed = 0;
+    for(size_t i = 0; i < cases.size(); ++i)
+    {
+        size_t other = pcg(seed) % dataset.size();
+        cases[i].colors = dataset.colors.data() + i * 9;
+        cases[i].cur_color = cases[i].colors[4];
+        cases[i].prev_color = dataset.colors[other * 9 + 4];
+    }
+
+#if defined(__AVX512FP16__)
+    const char* half_kind = "native AVX-512 FP16";
+#elif defined(__F16C__)
+    const char* half_kind = "emulated with F16C";
+#else
+    const char* half_kind = "emulated in software";
+#endif
+    printf("%zu clipping cases, fp16 %s\n", cases.size(), half_kind);
+    printf("%-24s %5s %12s %12s %12s %12s %12s %10s\n",
+        "axis set", "axes", "fp32 ns", "fp16 ns", "mean err", "p99 err", "max err", "misses");
+
+    for(const axis_set& set: sets)
+    {
+        std::vector<vec3> full, half;
+        std::vector<bool> full_hits, half_hits;
+        double full_time = time_clipping<float>(cases, set, full, full_hits);
+        double half_time = time_clipping<kdop_half>(cases, set, half, half_hits);
+
+        // Error is the largest difference between color components. A miss is
+        // when fp16 fails to hit the k-DOP at all and returns the current
+        // color, although fp32 did hit it. In flat neighborhoods, the
+        // epsilon padding of the extents vanishes in fp16, so those often miss
+        // while fp32 only moves the color by about epsilon.
+        std::vector<float> errors(cases.size());
+        double sum_error = 0;
+        size_t misses = 0;
+        for(size_t i = 0; i < cases.size(); ++i)
+        {
+            vec3 delta = abs(half[i] - full[i]);
+            errors[i] = std::max(delta.x, std::max(delta.y, delta.z));
+            sum_error += errors[i];
+            if(full_hits[i] && !half_hits[i])
+                misses++;
+        }
+        std::sort(errors.begin(), errors.end());
+
+        printf("%-24s %5zu %12.2f %12.2f %12.3e %12.3e %12.3e %10zu\n",
+            set.name.c_str(),
+            set.axes.size(),
+            full_time / cases.size() * 1e9,
+            half_time / cases.size() * 1e9,
+            sum_error / cases.size(),
+            errors[errors.size() * 99 / 100],
+            errors.back(),
+            misses
+        );
+    }
+    return 0;
+}
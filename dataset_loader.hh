@@ -0,0 +1,446 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Builds a neighborhood dataset from many images on background threads, so
+// that optimization can start before all of them are loaded.
+#ifndef KDOP_DATASET_LOADER_HH
+#define KDOP_DATASET_LOADER_HH
+#include "image_cost.hh"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// FNV-1a, for keying cached data by file contents.
+inline uint64_t hash_bytes(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline bool read_file(const char* path, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data.resize(size > 0 ? size : 0);
+    bool success = size >= 0 && fread(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return success;
+}
+
+// Shards store one image's neighborhoods, so that unchanged images don't need
+// to be decoded and processed again. Version 2 adds neighborhood weights.
+constexpr char dataset_shard_magic_v1[8] = {'K', 'D', 'O', 'P', 'S', 'H', 'D', '1'};
+constexpr char dataset_shard_magic[8] = {'K', 'D', 'O', 'P', 'S', 'H', 'D', '2'};
+
+inline bool read_dataset_shard(const std::string& path, neighborhood_dataset& dataset)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f) return false;
+
+    char magic[8];
+    uint64_t count = 0;
+    uint64_t fixed_count = 0;
+    uint64_t weight_count = 0;
+    bool success = fread(magic, sizeof(magic), 1, f) == 1;
+    bool has_weights = success && memcmp(magic, dataset_shard_magic, sizeof(magic)) == 0;
+    success = success && (
+        has_weights || memcmp(magic, dataset_shard_magic_v1, sizeof(magic)) == 0
+    );
+    success = success &&
+        fread(&count, sizeof(count), 1, f) == 1 &&
+        fread(&fixed_count, sizeof(fixed_count), 1, f) == 1 &&
+        (!has_weights || fread(&weight_count, sizeof(weight_count), 1, f) == 1);
+
+    // Reject truncated or corrupt shards before allocating anything, so that
+    // they're rebuilt instead.
+    if(success)
+    {
+        uint64_t neighborhoods = count / 9;
+        uint64_t payload =
+            count * sizeof(vec3) +
+            fixed_count * sizeof(int16_t) +
+            weight_count * sizeof(float);
+        long header = ftell(f);
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, header, SEEK_SET);
+        success = count % 9 == 0 &&
+            (fixed_count == 0 || fixed_count == count * 4) &&
+            (weight_count == 0 || weight_count == neighborhoods) &&
+            header >= 0 && size >= header && count <= uint64_t(size) &&
+            uint64_t(size - header) == payload;
+    }
+    if(success)
+    {
+        dataset.colors.resize(count);
+        dataset.fixed_colors.resize(fixed_count);
+        dataset.weights.resize(weight_count);
+        success =
+            fread(dataset.colors.data(), sizeof(vec3), count, f) == count &&
+            fread(dataset.fixed_colors.data(), sizeof(int16_t), fixed_count, f) == fixed_count &&
+            fread(dataset.weights.data(), sizeof(float), weight_count, f) == weight_count;
+    }
+    fclose(f);
+    if(!success)
+        dataset = neighborhood_dataset();
+    return success;
+}
+
+// Writes to a temporary file first, so that an interrupted write never leaves
+// a truncated shard behind.
+inline bool write_dataset_shard(const std::string& path, const neighborhood_dataset& dataset)
+{
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if(!f) return false;
+
+    uint64_t count = dataset.colors.size();
+    uint64_t fixed_count = dataset.fixed_colors.size();
+    uint64_t weight_count = dataset.weights.size();
+    bool success =
+        fwrite(dataset_shard_magic, sizeof(dataset_shard_magic), 1, f) == 1 &&
+        fwrite(&count, sizeof(count), 1, f) == 1 &&
+        fwrite(&fixed_count, sizeof(fixed_count), 1, f) == 1 &&
+        fwrite(&weight_count, sizeof(weight_count), 1, f) == 1 &&
+        fwrite(dataset.colors.data(), sizeof(vec3), count, f) == count &&
+        fwrite(dataset.fixed_colors.data(), sizeof(int16_t), fixed_count, f) == fixed_count &&
+        fwrite(dataset.weights.data(), sizeof(float), weight_count, f) == weight_count;
+    success = fclose(f) == 0 && success;
+    if(success)
+        success = rename(tmp_path.c_str(), path.c_str()) == 0;
+    if(!success)
+        remove(tmp_path.c_str());
+    return success;
+}
+
+// Counts the large allocations made for datasets and remembers the highest
+// total, so that memory budgets can be checked. Thread safe.
+class memory_tracker
+{
+public:
+    void allocate(size_t bytes)
+    {
+        size_t now = current.fetch_add(bytes) + bytes;
+        size_t prev = high_water.load();
+        while(now > prev && !high_water.compare_exchange_weak(prev, now));
+    }
+
+    void release(size_t bytes)
+    {
+        current.fetch_sub(bytes);
+    }
+
+    size_t usage() const { return current.load(); }
+    size_t peak() const { return high_water.load(); }
+
+private:
+    std::atomic<size_t> current{0};
+    std::atomic<size_t> high_water{0};
+};
+
+// How to build a dataset within a memory budget.
+struct dataset_plan
+{
+    size_t thread_count = 1;
+    // Most neighborhoods that each source may have.
+    size_t neighborhoods_per_source = 0;
+};
+
+// 'source_bytes' is the temporary memory that loading one source takes, e.g.
+// the file and the decoder's buffers. 'extra_neighborhood_bytes' is memory
+// needed per neighborhood in the final dataset outside of it, e.g. by the
+// adaptive sampler. Returns false if a source takes more than the quarter of
+// the budget reserved for decoding, or if not even a small dataset fits.
+inline bool plan_dataset(
+    size_t budget,
+    size_t source_count,
+    size_t source_bytes,
+    size_t extra_neighborhood_bytes,
+    size_t max_threads,
+    dataset_plan& plan
+){
+    // While an epoch is published, the loaded sources, the new epoch and the
+    // previous one that is still in use can all exist at once.
+    const size_t dataset_copies = 3;
+    const size_t min_neighborhoods = 1000;
+    if(source_count == 0) return false;
+
+    // Decoding gets at most a quarter of the budget, by limiting how many
+    // sources are loaded in parallel.
+    size_t decode_budget = budget / 4;
+    if(source_bytes > decode_budget) return false;
+    size_t threads = std::max(std::min(max_threads, source_count), size_t(1));
+    if(source_bytes > 0)
+        threads = std::min(threads, decode_budget / source_bytes);
+    size_t reserved = threads * source_bytes;
+
+    size_t bytes_per_neighborhood =
+        source_count * (dataset_copies * neighborhood_bytes + extra_neighborhood_bytes) +
+        threads * deduplication_entry_bytes;
+    plan.thread_count = threads;
+    plan.neighborhoods_per_source = (budget - reserved) / bytes_per_neighborhood;
+    return plan.neighborhoods_per_source >= min_neighborhoods;
+}
+
+// Parses sizes like "512M" or "2G". Returns 0 on failure.
+inline size_t parse_memory_size(const char* str)
+{
+    char* end = nullptr;
+    double value = strtod(str, &end);
+    if(end == str || value <= 0) return 0;
+    switch(*end)
+    {
+    case 'k': case 'K': value *= 1024.0; ++end; break;
+    case 'm': case 'M': value *= 1024.0 * 1024.0; ++end; break;
+    case 'g': case 'G': value *= 1024.0 * 1024.0 * 1024.0; ++end; break;
+    default: break;
+    }
+    if(*end == 'B' || *end == 'b') ++end;
+    return *end == 0 ? size_t(value) : 0;
+}
+
+// Loads dataset sources (e.g. images) in parallel and publishes the result in
+// epochs. Each epoch is a complete snapshot of the sources loaded so far, in
+// source order. A new epoch is only published once the loaded neighborhood
+// count has doubled, or when everything is loaded, so that a consumer
+// re-scoring on each epoch does so only a logarithmic number of times.
+class progressive_dataset
+{
+public:
+    // Fills 'out' with the neighborhoods of source 'index'. Returns false if
+    // the source couldn't be loaded. Called from background threads.
+    using source_loader = std::function<bool(size_t index, neighborhood_dataset& out)>;
+
+    // If 'tracker' is given, loaded sources and published epochs are counted
+    // in it. Memory used by 'loader' itself is up to it to count.
+    progressive_dataset(
+        size_t source_count,
+        source_loader loader,
+        size_t thread_count = 0,
+        memory_tracker* tracker = nullptr
+    ):  loader(std::move(loader)), tracker(tracker), parts(source_count),
+        part_bytes(source_count, 0), loaded(source_count, false)
+    {
+        if(thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        thread_count = std::min(thread_count, source_count);
+        remaining = source_count;
+        if(source_count == 0)
+            finished = true;
+        for(size_t i = 0; i < thread_count; ++i)
+            threads.emplace_back([this](){ worker(); });
+    }
+
+    ~progressive_dataset()
+    {
+        cancelled = true;
+        for(std::thread& t: threads)
+            t.join();
+    }
+
+    // Blocks until the first epoch is published. Returns null if no source
+    // could be loaded.
+    std::shared_ptr<const neighborhood_dataset> wait_first()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        published_cv.wait(lock, [&](){ return latest || finished; });
+        consumed_epoch = epoch;
+        return latest;
+    }
+
+    // Blocks until all sources are loaded. Returns the final dataset if it
+    // hasn't been returned yet, null otherwise.
+    std::shared_ptr<const neighborhood_dataset> wait_complete()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        published_cv.wait(lock, [&](){ return finished; });
+        return take_new_epoch();
+    }
+
+    // Returns the newest epoch if it hasn't been returned yet, null
+    // otherwise. Never blocks on loading.
+    std::shared_ptr<const neighborhood_dataset> poll()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return take_new_epoch();
+    }
+
+    bool complete() const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return finished;
+    }
+
+    // Number of sources included in the newest epoch.
+    size_t published_sources() const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return latest_sources;
+    }
+
+    size_t source_count() const { return parts.size(); }
+
+private:
+    std::shared_ptr<const neighborhood_dataset> take_new_epoch()
+    {
+        if(consumed_epoch == epoch)
+            return nullptr;
+        consumed_epoch = epoch;
+        return latest;
+    }
+
+    void worker()
+    {
+        for(;;)
+        {
+            size_t index = next_source++;
+            if(index >= parts.size() || cancelled)
+                return;
+
+            neighborhood_dataset part;
+            bool success = loader(index, part);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if(success)
+            {
+                parts[index] = std::move(part);
+                loaded[index] = true;
+                loaded_size += parts[index].size();
+                part_bytes[index] = parts[index].memory_usage();
+                if(tracker) tracker->allocate(part_bytes[index]);
+            }
+            remaining--;
+            if(remaining == 0)
+                finished = true;
+
+            bool grown = loaded_size != 0 && loaded_size >= 2 * published_size;
+            if((finished && loaded_size != published_size) || grown)
+                publish();
+            if(finished)
+            {
+                // Everything is in the last epoch now.
+                for(size_t i = 0; i < parts.size(); ++i)
+                {
+                    parts[i] = neighborhood_dataset();
+                    if(tracker) tracker->release(part_bytes[i]);
+                    part_bytes[i] = 0;
+                }
+                published_cv.notify_all();
+            }
+        }
+    }
+
+    // Called with the mutex held.
+    void publish()
+    {
+        bool weighted = false;
+        for(size_t i = 0; i < parts.size(); ++i)
+            weighted = weighted || (loaded[i] && parts[i].weights.size() != 0);
+
+        auto snapshot = std::make_unique<neighborhood_dataset>();
+        snapshot->colors.reserve(loaded_size * 9);
+        snapshot->fixed_colors.reserve(loaded_size * 9 * 4);
+        if(weighted)
+            snapshot->weights.reserve(loaded_size);
+        size_t sources = 0;
+        for(size_t i = 0; i < parts.size(); ++i)
+        {
+            if(!loaded[i]) continue;
+            const neighborhood_dataset& part = parts[i];
+            if(part.weights.size() != 0)
+            {
+                snapshot->weights.insert(
+                    snapshot->weights.end(),
+                    part.weights.begin(), part.weights.end()
+                );
+            }
+            else if(weighted)
+            {
+                // Give unweighted sources the same total weight of one.
+                snapshot->weights.resize(
+                    snapshot->weights.size() + part.size(), 1.0f / part.size()
+                );
+            }
+            snapshot->colors.insert(
+                snapshot->colors.end(), part.colors.begin(), part.colors.end()
+            );
+            snapshot->fixed_colors.insert(
+                snapshot->fixed_colors.end(),
+                part.fixed_colors.begin(), part.fixed_colors.end()
+            );
+            sources++;
+        }
+        // Fixed point colors are only usable if every source had them.
+        if(snapshot->fixed_colors.size() != snapshot->colors.size() * 4)
+            snapshot->fixed_colors.clear();
+
+        size_t bytes = snapshot->memory_usage();
+        memory_tracker* tracker = this->tracker;
+        if(tracker) tracker->allocate(bytes);
+        latest = std::shared_ptr<const neighborhood_dataset>(
+            snapshot.release(),
+            [tracker, bytes](const neighborhood_dataset* d)
+            {
+                if(tracker) tracker->release(bytes);
+                delete d;
+            }
+        );
+        latest_sources = sources;
+        published_size = loaded_size;
+        epoch++;
+        published_cv.notify_all();
+    }
+
+    source_loader loader;
+    memory_tracker* tracker;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_source{0};
+    std::atomic<bool> cancelled{false};
+
+    mutable std::mutex mutex;
+    std::condition_variable published_cv;
+    std::vector<neighborhood_dataset> parts;
+    std::vector<size_t> part_bytes;
+    std::vector<bool> loaded;
+    size_t remaining = 0;
+    size_t loaded_size = 0;
+    size_t published_size = 0;
+    bool finished = false;
+
+    std::shared_ptr<const neighborhood_dataset> latest;
+    size_t latest_sources = 0;
+    size_t epoch = 0;
+    size_t consumed_epoch = 0;
+};
+
+#endif
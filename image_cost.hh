@@ -0,0 +1,825 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Cost function of the image optimizer: the average k-DOP volume around 3x3
+// color neighborhoods sampled from images.
+#ifndef KDOP_IMAGE_COST_HH
+#define KDOP_IMAGE_COST_HH
+#include <glm/glm.hpp>
+#include "kdop_volume.hh"
+#include "optimizer.hh"
+#include <cstdint>
+#include <optional>
+#include <array>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+using namespace glm;
+
+// Linear colors are stored in 15 bits, so that they fit in the signed 16-bit
+// inputs of pmaddwd / vpdpwssd. Axes use the same scale.
+constexpr float fixed_point_scale = 32767.0f;
+
+// Color neighborhoods sampled from images. Colors are linearized once here,
+// so that evaluating an axis set doesn't need to touch the images again.
+struct neighborhood_dataset
+{
+    // Nine linear colors per neighborhood.
+    std::vector<vec3> colors;
+    // The same colors in fixed point, four components per color with the last
+    // one being zero padding. Only available for 8-bit input.
+    std::vector<int16_t> fixed_colors;
+    // Optional weight of each neighborhood. If empty, all neighborhoods count
+    // equally. Weighted representations give each image a total weight of
+    // (about) one.
+    std::vector<float> weights;
+
+    size_t size() const { return colors.size() / 9; }
+
+    size_t memory_usage() const
+    {
+        return colors.capacity() * sizeof(vec3) +
+            fixed_colors.capacity() * sizeof(int16_t) +
+            weights.capacity() * sizeof(float);
+    }
+};
+
+// Memory taken by one neighborhood in a weighted dataset.
+constexpr size_t neighborhood_bytes =
+    9 * sizeof(vec3) + 9 * 4 * sizeof(int16_t) + sizeof(float);
+
+inline const uint16_t* get_srgb_to_fixed_lut()
+{
+    static const std::vector<uint16_t> lut = []()
+    {
+        const float gamma = 2.2f;
+        std::vector<uint16_t> lut(256);
+        for(int i = 0; i < 256; ++i)
+            lut[i] = uint16_t(round(pow(i / 255.0f, gamma) * fixed_point_scale));
+        return lut;
+    }();
+    return lut.data();
+}
+
+inline const float* get_srgb_to_linear_lut()
+{
+    static const std::vector<float> lut = []()
+    {
+        const float gamma = 2.2f;
+        std::vector<float> lut(256);
+        for(int i = 0; i < 256; ++i)
+            lut[i] = pow(i / 255.0f, gamma);
+        return lut;
+    }();
+    return lut.data();
+}
+
+// Appends the 3x3 neighborhood centered at (x, y). The center must not be on
+// the image border.
+inline void append_neighborhood(
+    neighborhood_dataset& dataset,
+    int w,
+    const uint8_t* image_data,
+    int x,
+    int y
+){
+    const float* linear = get_srgb_to_linear_lut();
+    const uint16_t* lut = get_srgb_to_fixed_lut();
+    for(int j = -1; j <= 1; ++j)
+    for(int i = -1; i <= 1; ++i)
+    {
+        const uint8_t* pixel = image_data + (x+i)*3 + (y+j)*w*3;
+        dataset.colors.push_back(vec3(
+            linear[pixel[0]], linear[pixel[1]], linear[pixel[2]]
+        ));
+        for(int c = 0; c < 3; ++c)
+            dataset.fixed_colors.push_back(lut[pixel[c]]);
+        dataset.fixed_colors.push_back(0);
+    }
+}
+
+// Uniformly random neighborhoods, all with the same weight. This is the
+// default representation, as its size doesn't depend on the image.
+inline void sample_neighborhoods(
+    neighborhood_dataset& dataset,
+    int w,
+    int h,
+    const uint8_t* image_data,
+    uint seed,
+    size_t count
+){
+    for(size_t a = 0; a < count; ++a)
+    {
+        uint cur_seed = seed+a;
+        int x = clamp(int(generate_uniform_random(cur_seed) * (w-2)+1), 1, w-2);
+        int y = clamp(int(generate_uniform_random(cur_seed) * (h-2)+1), 1, h-2);
+        append_neighborhood(dataset, w, image_data, x, y);
+    }
+}
+
+inline size_t full_neighborhood_count(int w, int h)
+{
+    return w > 2 && h > 2 ? size_t(w-2) * size_t(h-2) : 0;
+}
+
+// Every neighborhood of the image, so the cost is exact.
+inline void build_full_neighborhoods(
+    neighborhood_dataset& dataset,
+    int w,
+    int h,
+    const uint8_t* image_data
+){
+    size_t count = full_neighborhood_count(w, h);
+    dataset.colors.reserve(dataset.colors.size() + count * 9);
+    dataset.fixed_colors.reserve(dataset.fixed_colors.size() + count * 9 * 4);
+    dataset.weights.reserve(dataset.weights.size() + count);
+    for(int y = 1; y < h-1; ++y)
+    for(int x = 1; x < w-1; ++x)
+    {
+        append_neighborhood(dataset, w, image_data, x, y);
+        dataset.weights.push_back(1.0f / count);
+    }
+}
+
+// Upper bound of the temporary memory taken by each distinct neighborhood in
+// build_deduplicated_neighborhoods(): a hash map node and bucket, and an
+// occurrence count.
+constexpr size_t deduplication_entry_bytes = 80;
+
+// Every distinct neighborhood of the image, weighted by how often it occurs.
+// This is exact like build_full_neighborhoods(), but much smaller for images
+// with flat or repeating areas. Gives up and returns false if there are more
+// than 'max_count' distinct neighborhoods.
+inline bool build_deduplicated_neighborhoods(
+    neighborhood_dataset& dataset,
+    int w,
+    int h,
+    const uint8_t* image_data,
+    size_t max_count
+){
+    typedef std::array<uint8_t, 27> key;
+    struct key_hash
+    {
+        size_t operator()(const key& k) const
+        {
+            // FNV-1a
+            size_t hash = 14695981039346656037ull;
+            for(uint8_t b: k)
+            {
+                hash ^= b;
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    };
+
+    size_t count = full_neighborhood_count(w, h);
+    size_t first = dataset.size();
+    std::unordered_map<key, uint32_t, key_hash> indices;
+    indices.reserve(std::min(count, max_count));
+    // Counted as integers, since adding up millions of tiny float weights
+    // would bias the most common neighborhoods.
+    std::vector<uint32_t> occurrences;
+    occurrences.reserve(std::min(count, max_count));
+    // Reserved up front, so that growing doesn't briefly take twice the
+    // memory.
+    dataset.colors.reserve(dataset.colors.size() + std::min(count, max_count) * 9);
+    dataset.fixed_colors.reserve(dataset.fixed_colors.size() + std::min(count, max_count) * 9 * 4);
+    dataset.weights.reserve(dataset.weights.size() + std::min(count, max_count));
+    for(int y = 1; y < h-1; ++y)
+    for(int x = 1; x < w-1; ++x)
+    {
+        key k;
+        for(int j = -1; j <= 1; ++j)
+            memcpy(k.data() + (j+1)*9, image_data + (x-1)*3 + (y+j)*w*3, 9);
+
+        auto it = indices.emplace(k, uint32_t(dataset.size() - first));
+        if(it.second)
+        {
+            if(indices.size() > max_count)
+            {
+                // Release the memory too, as the caller will likely build
+                // another representation next.
+                dataset.colors.resize(first * 9);
+                dataset.colors.shrink_to_fit();
+                dataset.fixed_colors.resize(first * 9 * 4);
+                dataset.fixed_colors.shrink_to_fit();
+                dataset.weights.shrink_to_fit();
+                return false;
+            }
+            append_neighborhood(dataset, w, image_data, x, y);
+            occurrences.push_back(0);
+        }
+        occurrences[it.first->second]++;
+    }
+    for(uint32_t n: occurrences)
+        dataset.weights.push_back(float(double(n) / count));
+    return true;
+}
+
+// A weighted subset of 'count' neighborhoods. Flat neighborhoods have zero
+// volume with any axes, so neighborhoods are drawn with probability mostly
+// proportional to their color spread, plus a uniform part so that none are
+// left out. Importance weights keep the cost an unbiased estimate of the full
+// image. Uses two passes over the image instead of storing per-pixel
+// probabilities, so it needs no memory beyond the result.
+inline void build_coreset_neighborhoods(
+    neighborhood_dataset& dataset,
+    int w,
+    int h,
+    const uint8_t* image_data,
+    uint seed,
+    size_t count
+){
+    const float uniform_fraction = 0.1f;
+    const float* linear = get_srgb_to_linear_lut();
+    auto spread = [&](int x, int y)
+    {
+        vec3 lo = vec3(1);
+        vec3 hi = vec3(0);
+        for(int j = -1; j <= 1; ++j)
+        for(int i = -1; i <= 1; ++i)
+        {
+            const uint8_t* pixel = image_data + (x+i)*3 + (y+j)*w*3;
+            vec3 c = vec3(linear[pixel[0]], linear[pixel[1]], linear[pixel[2]]);
+            lo = min(lo, c);
+            hi = max(hi, c);
+        }
+        return double(hi.x - lo.x + hi.y - lo.y + hi.z - lo.z);
+    };
+
+    size_t n = full_neighborhood_count(w, h);
+    if(n == 0 || count == 0) return;
+    double total_spread = 0;
+    for(int y = 1; y < h-1; ++y)
+    for(int x = 1; x < w-1; ++x)
+        total_spread += spread(x, y);
+    double uniform = total_spread > 0 ? uniform_fraction : 1.0;
+
+    // Systematic sampling over the cumulative probabilities, like in
+    // adaptive_neighborhood_sampler::refresh().
+    double offset = generate_uniform_random(seed);
+    double cumulative = 0;
+    size_t j = 0;
+    for(int y = 1; y < h-1 && j < count; ++y)
+    for(int x = 1; x < w-1 && j < count; ++x)
+    {
+        double p = uniform / n;
+        if(total_spread > 0)
+            p += (1.0 - uniform) * spread(x, y) / total_spread;
+        cumulative += p;
+        bool drawn = false;
+        while(j < count && (j + offset) / count < cumulative)
+        {
+            if(!drawn)
+            {
+                append_neighborhood(dataset, w, image_data, x, y);
+                dataset.weights.push_back(0.0f);
+                drawn = true;
+            }
+            dataset.weights.back() += 1.0 / (count * p * n);
+            ++j;
+        }
+    }
+}
+
+enum class dataset_representation
+{
+    SAMPLED = 0,
+    FULL,
+    DEDUPLICATED,
+    CORESET
+};
+
+inline const char* dataset_representation_name(dataset_representation r)
+{
+    switch(r)
+    {
+    case dataset_representation::SAMPLED: return "sampled";
+    case dataset_representation::FULL: return "full";
+    case dataset_representation::DEDUPLICATED: return "deduplicated";
+    case dataset_representation::CORESET: return "coreset";
+    }
+    return "unknown";
+}
+
+// Builds the most accurate representation of the image that has at most
+// 'max_count' neighborhoods: all of them, the distinct ones, or a coreset.
+// Deduplication also needs up to 'max_count' * deduplication_entry_bytes of
+// temporary memory.
+inline dataset_representation build_budgeted_neighborhoods(
+    neighborhood_dataset& dataset,
+    int w,
+    int h,
+    const uint8_t* image_data,
+    uint seed,
+    size_t max_count
+){
+    if(full_neighborhood_count(w, h) <= max_count)
+    {
+        build_full_neighborhoods(dataset, w, h, image_data);
+        return dataset_representation::FULL;
+    }
+    if(build_deduplicated_neighborhoods(dataset, w, h, image_data, max_count))
+        return dataset_representation::DEDUPLICATED;
+    build_coreset_neighborhoods(dataset, w, h, image_data, seed, max_count);
+    return dataset_representation::CORESET;
+}
+
+// Axes quantized to 16 bits, packed in pairs for pmaddwd: 'xy' has x in the
+// low and y in the high half of each 32-bit lane, 'z' has z and zero.
+struct fixed_point_axes
+{
+    alignas(64) int32_t xy[kdop_max_axis_count];
+    alignas(64) int32_t z[kdop_max_axis_count];
+};
+
+inline int32_t pack_int16_pair(int lo, int hi)
+{
+    return int32_t(uint32_t(uint16_t(int16_t(lo))) | (uint32_t(uint16_t(int16_t(hi))) << 16));
+}
+
+inline fixed_point_axes quantize_axes(const vec3* axes, size_t axis_count)
+{
+    fixed_point_axes fixed = {};
+    for(size_t j = 0; j < axis_count; ++j)
+    {
+        ivec3 q = ivec3(round(axes[j] * fixed_point_scale));
+        fixed.xy[j] = pack_int16_pair(q.x, q.y);
+        fixed.z[j] = pack_int16_pair(q.z, 0);
+    }
+    return fixed;
+}
+
+// Two adjacent 16-bit components as one 32-bit lane, for the pairwise
+// multiply-adds.
+inline int32_t load_int16_pair(const int16_t* p)
+{
+    int32_t pair;
+    memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+// Integer version of the projection loop in find_kdop_extents(). Results are
+// scaled by fixed_point_scale^2. With unit axes, the dot products stay below
+// 32767^2 * sqrt(3) < 2^31, so they can't overflow.
+inline void find_fixed_point_extents(
+    const int16_t* points,
+    const fixed_point_axes& axes,
+    size_t axis_count,
+    int32_t* mins,
+    int32_t* maxs
+){
+#if defined(__AVX512F__) && defined(__AVX512VNNI__)
+    for(size_t j = 0; j < axis_count; j += 16)
+    {
+        __m512i axy = _mm512_load_si512(axes.xy + j);
+        __m512i az = _mm512_load_si512(axes.z + j);
+        __m512i lo = _mm512_set1_epi32(INT32_MAX);
+        __m512i hi = _mm512_set1_epi32(INT32_MIN);
+        for(size_t i = 0; i < 9; ++i)
+        {
+            __m512i d = _mm512_dpwssd_epi32(
+                _mm512_setzero_si512(), _mm512_set1_epi32(load_int16_pair(points + i*4)), axy
+            );
+            d = _mm512_dpwssd_epi32(d, _mm512_set1_epi32(load_int16_pair(points + i*4 + 2)), az);
+            lo = _mm512_min_epi32(lo, d);
+            hi = _mm512_max_epi32(hi, d);
+        }
+        _mm512_storeu_si512(mins + j, lo);
+        _mm512_storeu_si512(maxs + j, hi);
+    }
+#elif defined(__AVX2__)
+    for(size_t j = 0; j < axis_count; j += 8)
+    {
+        __m256i axy = _mm256_load_si256((const __m256i*)(axes.xy + j));
+        __m256i az = _mm256_load_si256((const __m256i*)(axes.z + j));
+        __m256i lo = _mm256_set1_epi32(INT32_MAX);
+        __m256i hi = _mm256_set1_epi32(INT32_MIN);
+        for(size_t i = 0; i < 9; ++i)
+        {
+            __m256i d = _mm256_add_epi32(
+                _mm256_madd_epi16(_mm256_set1_epi32(load_int16_pair(points + i*4)), axy),
+                _mm256_madd_epi16(_mm256_set1_epi32(load_int16_pair(points + i*4 + 2)), az)
+            );
+            lo = _mm256_min_epi32(lo, d);
+            hi = _mm256_max_epi32(hi, d);
+        }
+        _mm256_storeu_si256((__m256i*)(mins + j), lo);
+        _mm256_storeu_si256((__m256i*)(maxs + j), hi);
+    }
+#else
+    for(size_t j = 0; j < axis_count; ++j)
+    {
+        int ax = int16_t(axes.xy[j] & 0xFFFF);
+        int ay = int16_t(axes.xy[j] >> 16);
+        int az = int16_t(axes.z[j] & 0xFFFF);
+        mins[j] = INT32_MAX;
+        maxs[j] = INT32_MIN;
+        for(size_t i = 0; i < 9; ++i)
+        {
+            const int16_t* p = points + i*4;
+            int32_t d = p[0] * ax + p[1] * ay + p[2] * az;
+            mins[j] = std::min(mins[j], d);
+            maxs[j] = std::max(maxs[j], d);
+        }
+    }
+#endif
+}
+
+// One prefix of an ordered axis set, see image_cost_params::prefixes.
+struct axis_prefix
+{
+    size_t axis_count;
+    float weight;
+};
+
+struct image_cost_params
+{
+    // Calculate volumes through per-topology polynomials, see
+    // kdop_polynomial_cache.
+    bool polynomial_volume = false;
+    // Project colors with integer math, see find_fixed_point_extents().
+    // Requires a dataset with fixed_colors.
+    bool fixed_point = false;
+    // If not empty, the cost is the weighted sum of the volumes of the k-DOPs
+    // formed by these prefixes of the axis set, instead of the volume of the
+    // whole set. Optimizing that gives one ordered axis list that can be
+    // truncated to any of these lengths. Prefixes share the projections of
+    // the full set, so the extents are only calculated once.
+    std::vector<axis_prefix> prefixes;
+};
+
+inline void find_kdop_extents(
+    const vec3* points,
+    const vec3* axes,
+    size_t axis_count,
+    vec2* axis_extents
+){
+    for(size_t i = 0; i < axis_count; ++i)
+        axis_extents[i] = vec2(1e9, -1e9);
+
+    for(size_t i = 0; i < 9; ++i)
+    {
+        vec3 p = points[i];
+        for(size_t j = 0; j < axis_count; ++j)
+        {
+            auto& pair = axis_extents[j];
+            float d = dot(p, axes[j]);
+            pair.x = std::min(pair.x, d);
+            pair.y = std::max(pair.y, d);
+        }
+    }
+}
+
+inline void find_fixed_point_kdop_extents(
+    const int16_t* points,
+    const fixed_point_axes& fixed_axes,
+    size_t axis_count,
+    vec2* axis_extents
+){
+    alignas(64) int32_t mins[kdop_max_axis_count];
+    alignas(64) int32_t maxs[kdop_max_axis_count];
+    find_fixed_point_extents(points, fixed_axes, axis_count, mins, maxs);
+
+    const float inv_scale = 1.0f / (fixed_point_scale * fixed_point_scale);
+    for(size_t j = 0; j < axis_count; ++j)
+        axis_extents[j] = vec2(mins[j], maxs[j]) * inv_scale;
+}
+
+// Calculates volumes of dataset neighborhoods for one axis set. Holds
+// per-thread state, so use one per thread.
+class neighborhood_volume_evaluator
+{
+public:
+    // 'fixed_axes' must be given if fixed point projection is wanted.
+    neighborhood_volume_evaluator(
+        const neighborhood_dataset& dataset,
+        const vec3* axes,
+        size_t axis_count,
+        const fixed_point_axes* fixed_axes,
+        const image_cost_params& params
+    ):  dataset(dataset), axes(axes), axis_count(axis_count),
+        fixed_axes(fixed_axes), prefixes(params.prefixes)
+    {
+        if(prefixes.size() == 0)
+            prefixes.push_back({axis_count, 1.0f});
+        if(params.polynomial_volume)
+        {
+            caches.reserve(prefixes.size());
+            for(const axis_prefix& prefix: prefixes)
+                caches.emplace_back(prefix.axis_count, axes);
+        }
+    }
+
+    float operator()(size_t index)
+    {
+        vec2 axis_extents[kdop_max_axis_count];
+        if(fixed_axes)
+        {
+            find_fixed_point_kdop_extents(
+                dataset.fixed_colors.data() + index*9*4,
+                *fixed_axes, axis_count, axis_extents
+            );
+        }
+        else
+        {
+            find_kdop_extents(
+                dataset.colors.data() + index*9,
+                axes, axis_count, axis_extents
+            );
+        }
+
+        float volume = 0;
+        for(size_t i = 0; i < prefixes.size(); ++i)
+        {
+            const axis_prefix& prefix = prefixes[i];
+            float prefix_volume = caches.size() != 0 ?
+                caches[i].calc_volume(axis_extents) :
+                calc_kdop_volume(prefix.axis_count, axes, axis_extents);
+            volume += prefix.weight * prefix_volume;
+        }
+        return volume;
+    }
+
+private:
+    const neighborhood_dataset& dataset;
+    const vec3* axes;
+    size_t axis_count;
+    const fixed_point_axes* fixed_axes;
+    std::vector<axis_prefix> prefixes;
+    std::vector<kdop_polynomial_cache> caches;
+};
+
+// Returns null if fixed point projection isn't requested or available.
+inline const fixed_point_axes* prepare_fixed_point_axes(
+    const neighborhood_dataset& dataset,
+    const vec3* axes,
+    size_t axis_count,
+    const image_cost_params& params,
+    fixed_point_axes& storage
+){
+    if(!params.fixed_point || dataset.fixed_colors.size() == 0)
+        return nullptr;
+    storage = quantize_axes(axes, axis_count);
+    return &storage;
+}
+
+inline float evaluate_axes_cost(
+    const neighborhood_dataset& dataset,
+    const vec3* axes,
+    size_t axis_count,
+    const image_cost_params& params = {}
+){
+    float sum_volume = 0;
+    const size_t count = dataset.size();
+    const bool weighted = dataset.weights.size() != 0;
+    double total_weight = 0;
+    for(float w: dataset.weights)
+        total_weight += w;
+    fixed_point_axes fixed_storage;
+    const fixed_point_axes* fixed_axes = prepare_fixed_point_axes(
+        dataset, axes, axis_count, params, fixed_storage
+    );
+
+    #pragma omp parallel
+    {
+        neighborhood_volume_evaluator evaluator(
+            dataset, axes, axis_count, fixed_axes, params
+        );
+
+        #pragma omp for
+        for(size_t a = 0; a < count; ++a)
+        {
+            float volume = evaluator(a);
+            if(weighted) volume *= dataset.weights[a];
+            #pragma omp critical
+            sum_volume += volume;
+        }
+    }
+
+    sum_volume /= weighted ? total_weight : count;
+    return sum_volume;
+}
+
+struct adaptive_sampling_params
+{
+    // Candidates evaluated on the whole dataset before the first refocus, to
+    // get initial sensitivity estimates.
+    size_t warmup_evaluations = 10;
+    // Candidates evaluated between refocusing.
+    size_t refocus_interval = 100;
+    // Number of samples drawn per refocus, relative to dataset size.
+    float subset_fraction = 0.2f;
+    // Share of the sampling probability that is spread uniformly, so that
+    // no neighborhood is ignored for good.
+    float uniform_fraction = 0.2f;
+    // Weight of the newest volume in each neighborhood's running variance.
+    float decay = 0.1f;
+};
+
+// Late in the optimization, most neighborhoods have nearly the same volume
+// for every candidate, and only a few actually decide which candidate is
+// better. This tracks how much each neighborhood's volume varies between
+// candidates, and periodically resamples a subset of neighborhoods with
+// probabilities proportional to that. Importance weights keep the cost an
+// unbiased estimate of evaluate_axes_cost().
+//
+// The subset only changes in refresh(), so candidates between refreshes are
+// compared on the same samples. Use refresh() as the axis_objective's
+// refresh function so that the best axes get re-scored after a change.
+class adaptive_neighborhood_sampler
+{
+public:
+    adaptive_neighborhood_sampler(
+        const neighborhood_dataset& dataset,
+        const image_cost_params& cost_params,
+        const adaptive_sampling_params& params = {}
+    ):  dataset(dataset), cost_params(cost_params), params(params),
+        mean(dataset.size(), 0.0f), variance(dataset.size(), 0.0f),
+        observations(dataset.size(), 0)
+    {
+        for(float w: dataset.weights)
+            total_weight += w;
+
+        // Start out with the whole dataset.
+        subset.resize(dataset.size());
+        weights.resize(dataset.size());
+        for(size_t i = 0; i < subset.size(); ++i)
+        {
+            subset[i] = i;
+            weights[i] = target_weight(i);
+        }
+    }
+
+    float evaluate(const vec3* axes, size_t axis_count)
+    {
+        fixed_point_axes fixed_storage;
+        const fixed_point_axes* fixed_axes = prepare_fixed_point_axes(
+            dataset, axes, axis_count, cost_params, fixed_storage
+        );
+
+        double sum_volume = 0;
+        #pragma omp parallel
+        {
+            neighborhood_volume_evaluator evaluator(
+                dataset, axes, axis_count, fixed_axes, cost_params
+            );
+
+            // Each neighborhood is in the subset only once, so the statistics
+            // can be updated without synchronization.
+            double thread_sum = 0;
+            #pragma omp for
+            for(size_t s = 0; s < subset.size(); ++s)
+            {
+                uint32_t i = subset[s];
+                float volume = evaluator(i);
+                thread_sum += weights[s] * volume;
+                update_statistics(i, volume);
+            }
+
+            #pragma omp atomic
+            sum_volume += thread_sum;
+        }
+        evaluations++;
+        return sum_volume;
+    }
+
+    // Refocuses the subset if it's time to do so. Returns true if the subset
+    // changed.
+    bool refresh()
+    {
+        size_t interval = refocused ?
+            params.refocus_interval : params.warmup_evaluations;
+        if(evaluations < interval)
+            return false;
+        evaluations = 0;
+        refocused = true;
+
+        // Standard deviation is what matters for estimating differences
+        // between candidates. Neighborhoods without enough observations are
+        // assumed to be as sensitive as the worst known one.
+        size_t n = dataset.size();
+        std::vector<double> sensitivity(n);
+        double max_sensitivity = 0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            sensitivity[i] = sqrt(variance[i]);
+            max_sensitivity = std::max(max_sensitivity, sensitivity[i]);
+        }
+        // Neighborhoods that count for more in the cost also need to be
+        // sampled more.
+        double total_sensitivity = 0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(observations[i] < 2)
+                sensitivity[i] = max_sensitivity;
+            sensitivity[i] *= target_weight(i);
+            total_sensitivity += sensitivity[i];
+        }
+
+        double uniform = total_sensitivity > 0 ? params.uniform_fraction : 1.0;
+        std::vector<double> cdf(n);
+        double cumulative = 0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            double p = uniform * target_weight(i);
+            if(total_sensitivity > 0)
+                p += (1.0 - uniform) * sensitivity[i] / total_sensitivity;
+            cumulative += p;
+            cdf[i] = cumulative;
+        }
+
+        // Systematic sampling: one random offset, evenly spaced draws. Each
+        // neighborhood is drawn m*p times on average, so weighting each draw
+        // by its share of the cost divided by m*p keeps the estimate
+        // unbiased.
+        size_t m = std::max(size_t(1), size_t(params.subset_fraction * n));
+        double offset = generate_uniform_random(seed);
+        subset.clear();
+        weights.clear();
+        size_t i = 0;
+        for(size_t j = 0; j < m; ++j)
+        {
+            double u = (j + offset) / m * cumulative;
+            while(i+1 < n && cdf[i] < u) ++i;
+            double p = (cdf[i] - (i > 0 ? cdf[i-1] : 0)) / cumulative;
+            float w = target_weight(i) / (m * p);
+            if(subset.size() != 0 && subset.back() == i)
+                weights.back() += w;
+            else
+            {
+                subset.push_back(i);
+                weights.push_back(w);
+            }
+        }
+        return true;
+    }
+
+    size_t subset_size() const { return subset.size(); }
+
+    // Includes the temporary arrays of refresh().
+    static constexpr size_t bytes_per_neighborhood =
+        2 * sizeof(float) + 2 * sizeof(uint32_t) + sizeof(float) +
+        2 * sizeof(double);
+
+private:
+    // Share of neighborhood i in evaluate_axes_cost().
+    double target_weight(size_t i) const
+    {
+        if(dataset.weights.size() == 0)
+            return 1.0 / dataset.size();
+        return dataset.weights[i] / total_weight;
+    }
+
+    void update_statistics(size_t i, float volume)
+    {
+        if(observations[i]++ == 0)
+        {
+            mean[i] = volume;
+            variance[i] = 0;
+            return;
+        }
+        float delta = volume - mean[i];
+        mean[i] += params.decay * delta;
+        variance[i] = (1.0f - params.decay) *
+            (variance[i] + params.decay * delta * delta);
+    }
+
+    const neighborhood_dataset& dataset;
+    image_cost_params cost_params;
+    adaptive_sampling_params params;
+
+    std::vector<float> mean;
+    std::vector<float> variance;
+    std::vector<uint32_t> observations;
+
+    std::vector<uint32_t> subset;
+    std::vector<float> weights;
+    double total_weight = 0;
+    size_t evaluations = 0;
+    bool refocused = false;
+    uint seed = 0;
+};
+
+#endif
@@ -16,193 +16,558 @@
 // DEALINGS IN THE SOFTWARE.
 #include <glm/glm.hpp>
 #include "kdop_volume.hh"
+#include "optimizer.hh"
+#include "bayesian_optimizer.hh"
+#include "image_cost.hh"
+#include "dataset_loader.hh"
 #include <vector>
 #include <cstdio>
 #include <cmath>
 #include <clocale>
+#include <cstring>
+#include <string>
+#include <filesystem>
+#include <atomic>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 using namespace glm;
 
-uint pcg(uint& seed)
+bool is_integer(const char* str)
 {
-    seed = seed * 747796405u + 2891336453u;
-    seed = ((seed >> ((seed >> 28) + 4)) ^ seed) * 277803737u;
-    seed ^= seed >> 22;
-    return seed;
+    if(*str == 0) return false;
+    for(; *str; ++str)
+        if(*str < '0' || *str > '9') return false;
+    return true;
 }
 
-float generate_uniform_random(uint& seed)
+// Parses a comma-separated list of prefix lengths, each optionally followed by
+// ':weight'. Weights must be positive, as a negative one would reward a larger
+// volume for that prefix.
+bool parse_prefixes(const char* str, int axis_count, std::vector<axis_prefix>& prefixes)
 {
-    return pcg(seed) * 2.3283064365386963e-10f;
+    while(*str)
+    {
+        char* end = nullptr;
+        long length = strtol(str, &end, 10);
+        if(end == str || length < 3 || length > axis_count)
+            return false;
+        float weight = 1.0f;
+        if(*end == ':')
+        {
+            str = end+1;
+            weight = strtof(str, &end);
+            if(end == str || !(weight > 0.0f)) return false;
+        }
+        prefixes.push_back({size_t(length), weight});
+        if(*end == ',') ++end;
+        else if(*end) return false;
+        str = end;
+    }
+    return prefixes.size() != 0;
 }
 
-vec3 sample_sphere(vec2 u)
+// Axes from a previous run are stored with the number of forced axes, so that
+// they're only reused when the forced axes are the same.
+bool load_solution(const std::string& path, std::vector<vec3>& axes, int locked_axes)
 {
-    float cos_theta = 2.0f * u.x - 1.0f;
-    float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
-    float phi = u.y * 2.0f * M_PI;
-    return vec3(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);
-}
+    FILE* f = fopen(path.c_str(), "r");
+    if(!f) return false;
 
-vec3 sample_sphere(uint& seed)
-{
-    vec2 u;
-    u.x = generate_uniform_random(seed);
-    u.y = generate_uniform_random(seed);
-    return sample_sphere(u);
-}
-
-float find_kdop_volume(
-    const vec3* points,
-    const vec3* axes,
-    size_t axis_count
-){
-    vec2 axis_extents[32];
-    for(size_t i = 0; i < axis_count; ++i)
-        axis_extents[i] = vec2(1e9, -1e9);
+    int saved_locked_axes = -1;
+    std::vector<vec3> saved_axes(axes.size());
+    bool success = fscanf(f, "%d", &saved_locked_axes) == 1 && saved_locked_axes == locked_axes;
+    for(size_t i = 0; success && i < saved_axes.size(); ++i)
+    {
+        vec3& v = saved_axes[i];
+        success = fscanf(f, "%f %f %f", &v.x, &v.y, &v.z) == 3;
+    }
+    fclose(f);
 
-    for(size_t i = 0; i < 9; ++i)
+    for(int i = 0; success && i < locked_axes; ++i)
+        success = dot(saved_axes[i], axes[i]) > 0.99999f;
+    if(success)
     {
-        vec3 p = points[i];
-        for(size_t j = 0; j < axis_count; ++j)
-        {
-            auto& pair = axis_extents[j];
-            float d = dot(p, axes[j]);
-            pair.x = std::min(pair.x, d);
-            pair.y = std::max(pair.y, d);
-        }
+        for(size_t i = locked_axes; i < axes.size(); ++i)
+            axes[i] = normalize(saved_axes[i]);
     }
-    return calc_kdop_volume(axis_count, axes, axis_extents);
+    return success;
 }
 
-float evaluate_axes_cost(
-    int w,
-    int h,
-    const uint8_t* image_data,
-    const vec3* axes,
-    size_t axis_count,
-    uint seed,
-    size_t attempt_count = 10000
-){
-    float sum_volume = 0;
-    const float gamma = 2.2f;
-
-    #pragma omp parallel for
-    for(size_t a = 0; a < attempt_count; ++a)
-    {
-        uint cur_seed = seed+a;
-        int x = clamp(int(generate_uniform_random(cur_seed) * (w-2)+1), 1, w-2);
-        int y = clamp(int(generate_uniform_random(cur_seed) * (h-2)+1), 1, h-2);
-        vec3 neighborhood[9];
-        for(int i = -1; i <= 1; ++i)
-        for(int j = -1; j <= 1; ++j)
-        {
-            int xi = x+i;
-            int yi = y+j;
-            uint8_t ri = image_data[xi*3+yi*w*3];
-            uint8_t gi = image_data[xi*3+1+yi*w*3];
-            uint8_t bi = image_data[xi*3+2+yi*w*3];
-            float r = pow(ri / 255.0f, gamma);
-            float g = pow(gi / 255.0f, gamma);
-            float b = pow(bi / 255.0f, gamma);
-            neighborhood[i+1+3*(j+1)] = vec3(r, g, b);
-        }
-        float volume = find_kdop_volume(neighborhood, axes, axis_count);
-        #pragma omp critical
-        sum_volume += volume;
+void save_solution(const std::string& path, const std::vector<vec3>& axes, int locked_axes)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if(!f)
+    {
+        fprintf(stderr, "Failed to write %s\n", path.c_str());
+        return;
     }
+    fprintf(f, "%d\n", locked_axes);
+    for(const vec3& v: axes)
+        fprintf(f, "%.9g %.9g %.9g\n", v.x, v.y, v.z);
+    fclose(f);
+}
 
-    sum_volume /= attempt_count;
-    return sum_volume;
+// Upper bound of the memory that stb_image takes to decode an 8-bit image to
+// RGB, not counting the file itself. PNG is the worst case: the compressed
+// data, the inflated scanlines and the output image exist at once, plus
+// another output image if it has to be converted to RGB.
+size_t estimate_decode_bytes(size_t file_size, int w, int h, int channels)
+{
+    size_t pixels = size_t(w) * h;
+    size_t bytes = file_size + pixels * channels + h + pixels * 3;
+    if(channels != 3) bytes += pixels * 3;
+    return bytes;
 }
 
 int main(int argc, char** argv)
 {
-    if(argc < 3)
+    image_cost_params cost_params;
+    bool adaptive_sampling = false;
+    const char* cache_dir = nullptr;
+    size_t metropolis_evaluations = 0;
+    size_t bayesian_evaluations = 0;
+    const char* prefix_list = nullptr;
+    const char* memory_budget_str = nullptr;
+    std::vector<const char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--polynomial-volume") == 0)
+            cost_params.polynomial_volume = true;
+        else if(strcmp(argv[i], "--fixed-point") == 0)
+            cost_params.fixed_point = true;
+        else if(strcmp(argv[i], "--adaptive-sampling") == 0)
+            adaptive_sampling = true;
+        else if(strcmp(argv[i], "--cache") == 0 && i+1 < argc)
+            cache_dir = argv[++i];
+        else if(strcmp(argv[i], "--metropolis") == 0 && i+1 < argc)
+            metropolis_evaluations = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--bayesian") == 0 && i+1 < argc)
+            bayesian_evaluations = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--prefixes") == 0 && i+1 < argc)
+            prefix_list = argv[++i];
+        else if(strcmp(argv[i], "--memory-budget") == 0 && i+1 < argc)
+            memory_budget_str = argv[++i];
+        else args.push_back(argv[i]);
+    }
+
+    // Every argument before the axis count is an image.
+    size_t image_count = 0;
+    while(image_count < args.size() && !is_integer(args[image_count]))
+        image_count++;
+
+    if(image_count == 0 || image_count == args.size())
     {
-        printf("Usage: %s <filename> <axis_count> [forced axes...]\n", argv[0]);
+        printf("Usage: %s [options] <filenames...> <axis_count> [forced axes...]\n", argv[0]);
+        printf("Options:\n");
+        printf("    --polynomial-volume  Evaluate volumes with cached per-topology polynomials\n");
+        printf("    --fixed-point        Project colors to axes with integer math\n");
+        printf("    --adaptive-sampling  Focus evaluation on neighborhoods that differ between candidates\n");
+        printf("    --cache <dir>        Reuse per-image datasets and previous axes stored in <dir>\n");
+        printf("    --metropolis <n>     Use Metropolis annealing scheduled for and capped at n evaluations\n");
+        printf("    --bayesian <n>       Use Gaussian process Bayesian optimization for n evaluations\n");
+        printf("    --prefixes <list>    Optimize prefixes of the axis list, e.g. 4,6:2,8 (length:weight)\n");
+        printf("    --memory-budget <n>  Build the most accurate dataset that fits in n bytes (K/M/G suffixes)\n");
         return 1;
     }
 
     // Make atoi / atof behave predictably
     setlocale(LC_ALL, "C");
 
-    const char* filename = argv[1];
-    int axis_count = atoi(argv[2]);
+    std::vector<const char*> filenames(args.begin(), args.begin() + image_count);
+    args.erase(args.begin(), args.begin() + image_count);
+    int axis_count = atoi(args[0]);
+    if(axis_count < 3 || axis_count > int(kdop_max_axis_count))
+    {
+        fprintf(stderr, "Axis count must be between 3 and %zu\n", kdop_max_axis_count);
+        return 1;
+    }
+
+    if(prefix_list && !parse_prefixes(prefix_list, axis_count, cost_params.prefixes))
+    {
+        fprintf(stderr, "Invalid prefix list %s\n", prefix_list);
+        return 1;
+    }
+
+    size_t memory_budget = 0;
+    if(memory_budget_str && (memory_budget = parse_memory_size(memory_budget_str)) == 0)
+    {
+        fprintf(stderr, "Invalid memory budget %s\n", memory_budget_str);
+        return 1;
+    }
 
     std::vector<vec3> best_axes(axis_count, vec3(0));
     uint seed = 0;
 
     int locked_axes = 0;
-    for(int i = 0; i < argc-3; ++i)
+    for(int i = 0; i < int(args.size())-1; ++i)
     {
         int component_index = i%3;
         if(component_index == 0)
             locked_axes++;
-        best_axes[locked_axes-1][component_index] = atof(argv[3+i]);
+        best_axes[locked_axes-1][component_index] = atof(args[1+i]);
     }
     for(int i = 0; i < locked_axes; ++i)
         best_axes[i] = normalize(best_axes[i]);
     for(int i = locked_axes; i < axis_count; ++i)
         best_axes[i] = sample_sphere(seed);
 
-    int no_improvement = 0;
+    if(bayesian_evaluations > 0 && axis_count - locked_axes > bayesian_max_free_axes)
+    {
+        fprintf(
+            stderr, "--bayesian supports at most %d axes besides the forced ones\n",
+            bayesian_max_free_axes
+        );
+        return 1;
+    }
 
-    int w, h, n;
-    unsigned char* data = stbi_load(filename, &w, &h, &n, 3);
+    std::string solution_path;
+    bool warm_start = false;
+    if(cache_dir)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir, ec);
+        solution_path = std::string(cache_dir) + "/axes-" + std::to_string(axis_count) + ".txt";
+        warm_start = load_solution(solution_path, best_axes, locked_axes);
+        if(warm_start)
+            printf("Warm starting from %s\n", solution_path.c_str());
+    }
+
+    // Declared before the datasets, since they report to it when freed.
+    memory_tracker tracker;
 
-    int fail_count = 0;
-    float temperature = 1;
-    float best_score = 1e9f;
-    while(temperature > FLT_MIN)
+    // Without a budget, a fixed number of neighborhoods is sampled from each
+    // image. With one, each image gets an equal share of the budget and uses
+    // the most accurate representation that fits in it.
+    const size_t samples_per_image = 10000;
+    size_t thread_count = 0;
+    size_t neighborhood_limit = samples_per_image;
+    if(memory_budget)
     {
-        std::vector<vec3> axes = best_axes;
-        for(int i = locked_axes; i < axis_count; ++i)
-            axes[i] = normalize(axes[i] + temperature * sample_sphere(seed));
+        // The file is kept in memory while decoding.
+        size_t source_bytes = 0;
+        const char* largest_source = nullptr;
+        for(const char* filename: filenames)
+        {
+            std::error_code ec;
+            size_t file_size = std::filesystem::file_size(filename, ec);
+            int w = 0, h = 0, n = 0;
+            if(ec || !stbi_info(filename, &w, &h, &n))
+                continue;
+            size_t bytes = file_size + estimate_decode_bytes(file_size, w, h, n);
+            if(bytes > source_bytes)
+            {
+                source_bytes = bytes;
+                largest_source = filename;
+            }
+        }
+        if(source_bytes > memory_budget / 4)
+        {
+            fprintf(
+                stderr,
+                "Decoding %s takes up to %.1f MiB, but only a quarter of the "
+                "memory budget (%.1f MiB) is reserved for decoding\n",
+                largest_source, source_bytes / 1048576.0,
+                memory_budget / 4 / 1048576.0
+            );
+            return 1;
+        }
 
-        float cur_score = evaluate_axes_cost(
-            w,
-            h,
-            data,
-            axes.data(),
-            axes.size(),
-            0
+        dataset_plan plan;
+        if(!plan_dataset(
+            memory_budget, filenames.size(), source_bytes,
+            adaptive_sampling ? adaptive_neighborhood_sampler::bytes_per_neighborhood : 0,
+            std::max(1u, std::thread::hardware_concurrency()), plan
+        )){
+            fprintf(stderr, "Memory budget %s is too small for these images\n", memory_budget_str);
+            return 1;
+        }
+        thread_count = plan.thread_count;
+        neighborhood_limit = plan.neighborhoods_per_source;
+        printf(
+            "Memory budget allows %zu neighborhoods per image, loading on %zu threads\n",
+            neighborhood_limit, thread_count
         );
-        printf("%f: %e vs %e\n", temperature, cur_score, best_score);
+    }
 
-        //float acceptance =
-        //    cur_score < best_score ? 1 : exp(-(cur_score - best_score)/temperature);
-        //if(acceptance > generate_uniform_random(seed))
-        //if(generate_uniform_random(seed) < acceptance)
-        if(cur_score < best_score)
+    std::atomic<size_t> reused_shards{0};
+    std::atomic<size_t> representation_counts[4] = {};
+    progressive_dataset loader(
+        filenames.size(),
+        [&](size_t index, neighborhood_dataset& out)
         {
-            printf("Picked new best axes\n");
-            best_axes = axes;
-            best_score = cur_score;
-            fail_count = 0;
-            for(int i = 0; i < axis_count; ++i)
-                printf("    vec3(%f, %f, %f),\n", best_axes[i].x, best_axes[i].y, best_axes[i].z);
-        }
-        else
+            std::vector<uint8_t> file;
+            if(!read_file(filenames[index], file))
+            {
+                fprintf(stderr, "Failed to load %s\n", filenames[index]);
+                return false;
+            }
+            tracker.allocate(file.size());
+
+            int w = 0, h = 0, n = 0;
+            if(!stbi_info_from_memory(file.data(), file.size(), &w, &h, &n))
+            {
+                fprintf(stderr, "Failed to load %s\n", filenames[index]);
+                tracker.release(file.size());
+                return false;
+            }
+
+            // Shards from the budgeted representations are tagged with what
+            // they contain. Deduplicated shards are only valid if they still
+            // fit in the current budget.
+            dataset_representation representation = dataset_representation::SAMPLED;
+            std::string tag = std::to_string(samples_per_image);
+            if(memory_budget)
+            {
+                representation = full_neighborhood_count(w, h) <= neighborhood_limit ?
+                    dataset_representation::FULL : dataset_representation::DEDUPLICATED;
+                tag = representation == dataset_representation::FULL ? "full" : "dedup";
+            }
+
+            uint sample_seed = index * samples_per_image;
+            uint64_t hash = 0;
+            if(cache_dir)
+            {
+                // Shards are keyed by contents, and sampling is seeded by them
+                // too, so that adding, removing or reordering images doesn't
+                // invalidate the other shards.
+                hash = hash_bytes(file.data(), file.size());
+                sample_seed = uint(hash ^ (hash >> 32));
+            }
+            auto shard_path = [&](const std::string& tag)
+            {
+                char name[64];
+                snprintf(
+                    name, sizeof(name), "/%016llx-%s.shard",
+                    (unsigned long long)hash, tag.c_str()
+                );
+                return std::string(cache_dir) + name;
+            };
+            auto read_shard = [&](const std::string& tag)
+            {
+                return read_dataset_shard(shard_path(tag), out) &&
+                    out.size() <= neighborhood_limit;
+            };
+            auto finish = [&]()
+            {
+                representation_counts[size_t(representation)]++;
+                tracker.release(file.size());
+                return true;
+            };
+
+            std::string coreset_tag = "coreset-" + std::to_string(neighborhood_limit);
+            if(cache_dir)
+            {
+                bool found = read_shard(tag);
+                // A missing deduplicated shard may mean that there were too
+                // many distinct neighborhoods last time.
+                if(!found && representation == dataset_representation::DEDUPLICATED)
+                {
+                    found = read_shard(coreset_tag);
+                    if(found) representation = dataset_representation::CORESET;
+                }
+                if(found)
+                {
+                    reused_shards++;
+                    return finish();
+                }
+                out = neighborhood_dataset();
+            }
+
+            // The decoder's temporary buffers are freed by the time it
+            // returns, leaving just the image.
+            size_t decode_bytes = estimate_decode_bytes(file.size(), w, h, n);
+            size_t decoded_bytes = size_t(w) * h * 3;
+            tracker.allocate(decode_bytes);
+            unsigned char* data = stbi_load_from_memory(
+                file.data(), file.size(), &w, &h, &n, 3
+            );
+            tracker.release(decode_bytes - decoded_bytes);
+            if(!data)
+            {
+                fprintf(stderr, "Failed to load %s\n", filenames[index]);
+                tracker.release(decoded_bytes + file.size());
+                return false;
+            }
+            // Any representation has at most neighborhood_limit
+            // neighborhoods, and deduplication needs its table on top.
+            size_t work_bytes = 0;
+            if(memory_budget)
+            {
+                work_bytes = neighborhood_limit *
+                    (neighborhood_bytes + deduplication_entry_bytes);
+                tracker.allocate(work_bytes);
+                representation = build_budgeted_neighborhoods(
+                    out, w, h, data, sample_seed, neighborhood_limit
+                );
+            }
+            else sample_neighborhoods(
+                out, w, h, data, sample_seed, samples_per_image
+            );
+            // The loader tracks the result once this returns, count it here
+            // too while the image is still around. It's part of work_bytes
+            // until now.
+            tracker.release(work_bytes);
+            tracker.allocate(out.memory_usage());
+            stbi_image_free(data);
+            tracker.release(decoded_bytes + out.memory_usage());
+
+            if(cache_dir)
+            {
+                std::string path = shard_path(
+                    representation == dataset_representation::CORESET ? coreset_tag : tag
+                );
+                if(!write_dataset_shard(path, out))
+                    fprintf(stderr, "Failed to write %s\n", path.c_str());
+            }
+            return finish();
+        },
+        thread_count,
+        &tracker
+    );
+
+    // Start optimizing as soon as anything is loaded; the rest of the images
+    // are picked up as they come in.
+    std::shared_ptr<const neighborhood_dataset> dataset = loader.wait_first();
+    if(!dataset)
+        return 1;
+    auto report_dataset = [&]()
+    {
+        printf(
+            "Dataset has %zu neighborhoods from %zu/%zu images\n",
+            dataset->size(), loader.published_sources(), loader.source_count()
+        );
+    };
+    report_dataset();
+
+    annealing_params params;
+    params.initial_step = 1;
+    params.min_step = FLT_MIN;
+    params.patience = 100;
+    params.seed = seed;
+    params.verbosity = 2;
+    if(warm_start)
+    {
+        // Only refine the previous result. The output only has six decimals,
+        // so going much below that is pointless.
+        params.initial_step = 1.0f / 16.0f;
+        params.min_step = 1e-6f;
+    }
+    std::optional<adaptive_neighborhood_sampler> sampler;
+    size_t sampler_bytes = 0;
+    auto create_sampler = [&]()
+    {
+        if(!adaptive_sampling) return;
+        sampler_bytes = dataset->size() * adaptive_neighborhood_sampler::bytes_per_neighborhood;
+        tracker.allocate(sampler_bytes);
+        sampler.emplace(*dataset, cost_params);
+    };
+    create_sampler();
+    auto switch_dataset = [&](std::shared_ptr<const neighborhood_dataset> next)
+    {
+        sampler.reset();
+        tracker.release(sampler_bytes);
+        sampler_bytes = 0;
+        dataset = std::move(next);
+        create_sampler();
+        report_dataset();
+    };
+    axis_objective objective(
+        [&](const std::vector<vec3>& axes)
+        {
+            if(sampler)
+                return sampler->evaluate(axes.data(), axes.size());
+            return evaluate_axes_cost(
+                *dataset, axes.data(), axes.size(), cost_params
+            );
+        },
+        [&]()
         {
-            fail_count++;
-            if(fail_count > 100)
+            if(auto next = loader.poll())
             {
-                printf("Shrinking step size\n");
-                fail_count = 0;
-                temperature *= 0.5;
+                switch_dataset(std::move(next));
+                return true;
             }
+            return sampler && sampler->refresh();
+        }
+    );
+    // Evaluation counts given on the command line are shared by both phases
+    // of the optimization.
+    size_t evaluations_left = bayesian_evaluations > 0 ?
+        bayesian_evaluations : metropolis_evaluations;
+    auto optimize = [&](float initial_step)
+    {
+        if(bayesian_evaluations > 0)
+        {
+            bayesian_params bparams;
+            bparams.max_evaluations = evaluations_left;
+            bparams.seed = params.seed;
+            bparams.verbosity = params.verbosity;
+            optimizer_result result = optimize_bayesian(
+                best_axes, locked_axes, objective, bparams
+            );
+            evaluations_left -= std::min(evaluations_left, result.evaluations);
+            return result;
         }
+        if(metropolis_evaluations > 0)
+        {
+            metropolis_params mparams;
+            mparams.initial_step = initial_step;
+            mparams.min_step = params.min_step;
+            mparams.schedule_length = evaluations_left;
+            mparams.seed = params.seed;
+            mparams.verbosity = params.verbosity;
+            optimizer_budget budget;
+            budget.max_evaluations = evaluations_left;
+            optimizer_result result = optimize_metropolis(
+                best_axes, locked_axes, objective, mparams, budget
+            );
+            evaluations_left -= std::min(evaluations_left, result.evaluations);
+            return result;
+        }
+        params.initial_step = initial_step;
+        return optimize_annealing(best_axes, locked_axes, objective, params);
+    };
+    best_axes = optimize(params.initial_step).best_axes;
+
+    // If the optimization converged before all images were loaded, continue
+    // from the result on the full dataset with a smaller step. The result is
+    // scored on the full dataset first and kept unless something beats it.
+    if(auto full = loader.wait_complete())
+    {
+        switch_dataset(std::move(full));
+        if((metropolis_evaluations == 0 && bayesian_evaluations == 0) || evaluations_left > 0)
+            best_axes = optimize(1.0f / 16.0f).best_axes;
+    }
+
+    if(cache_dir)
+    {
+        printf(
+            "Reused %zu/%zu cached image datasets\n",
+            reused_shards.load(), filenames.size()
+        );
+        save_solution(solution_path, best_axes, locked_axes);
+    }
+
+    if(memory_budget)
+    {
+        printf("Image datasets:");
+        for(size_t i = 1; i < 4; ++i)
+            printf(
+                "%s %zu %s", i == 1 ? "" : ",", representation_counts[i].load(),
+                dataset_representation_name(dataset_representation(i))
+            );
+        printf("\n");
+        printf(
+            "Peak tracked memory %.1f MiB, budget %.1f MiB\n",
+            tracker.peak() / 1048576.0, memory_budget / 1048576.0
+        );
     }
 
     printf("Finished axis optimization\n");
     for(int i = 0; i < axis_count; ++i)
         printf("    vec3(%f, %f, %f),\n", best_axes[i].x, best_axes[i].y, best_axes[i].z);
 
-    stbi_image_free(data);
-
     return 0;
 }
 
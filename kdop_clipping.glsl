@@ -46,6 +46,16 @@ const vec3 axes[] = vec3[](
     vec3(-0.554854, -0.041550, -0.830910)
 );
 
+// Number of axes actually used. Axis sets optimized with
+// 'image_optimizer --prefixes' are ordered so that their prefixes are good
+// k-DOPs too, so one list can serve several quality tiers by defining
+// KDOP_AXIS_COUNT to one of the optimized prefix lengths for each tier.
+#ifdef KDOP_AXIS_COUNT
+const int axis_count = KDOP_AXIS_COUNT;
+#else
+const int axis_count = axes.length();
+#endif
+
 // If you wanted to use a +-sized neighborhood instead, set this to 5. The
 // default assumes a 3x3 window. Window shape doesn't actually matter for this
 // algorithm, just the count. Smaller neighborhoods are faster and more likely
@@ -91,7 +101,7 @@ vec3 kdop_clipping(
 
     vec3 dir = prev_color - cur_color;
     float near = -1e9f, far = 1e9f;
-    [[unroll]] for(int a = 0; a < axes.length(); ++a)
+    [[unroll]] for(int a = 0; a < axis_count; ++a)
     {
         vec3 axis = axes[a];
         // Construct color extent along this axis
@@ -156,7 +166,7 @@ vec3 kdop_variance_clipping(
 ){
     vec3 dir = prev_color - cur_color;
     float near = -1e9f, far = 1e9f;
-    [[unroll]] for(int a = 0; a < axes.length(); ++a)
+    [[unroll]] for(int a = 0; a < axis_count; ++a)
     {
         vec3 axis = axes[a];
         vec2 moments = vec2(0);
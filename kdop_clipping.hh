@@ -0,0 +1,180 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// CPU reference for kdop_clipping() in kdop_clipping.glsl. It's templated on
+// the scalar type, so that the half-precision (mediump) math of mobile GPUs
+// can be replicated and compared against full precision.
+#ifndef KDOP_CLIPPING_HH
+#define KDOP_CLIPPING_HH
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#if defined(__F16C__) || defined(__AVX512FP16__)
+#include <immintrin.h>
+#endif
+using namespace glm;
+
+// Rounds to the nearest fp16 value (round-to-nearest-even), keeping the result
+// in a float.
+inline float round_to_half(float f)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT));
+#else
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t exponent = (bits >> 23) & 0xFF;
+    if(exponent == 0xFF) return f; // Inf & NaN stay as-is.
+    float a = fabs(f);
+    if(a >= 65520.0f) return copysign(INFINITY, f);
+    // Below 2^-14, fp16 values are denormals with a fixed step of 2^-24.
+    if(a < 6.103515625e-05f)
+        return copysign(nearbyint(a * 16777216.0f) / 16777216.0f, f);
+    // Otherwise, drop 13 bits of mantissa with round-to-nearest-even.
+    uint32_t lsb = (bits >> 13) & 1;
+    bits += 0xFFF + lsb;
+    bits &= ~0x1FFFu;
+    memcpy(&f, &bits, sizeof(bits));
+    return f;
+#endif
+}
+
+#if defined(__AVX512FP16__)
+// Native fp16 arithmetic.
+typedef _Float16 kdop_half;
+#else
+// Emulates fp16 arithmetic by rounding the result of every operation, like
+// a GPU with half-precision ALUs would.
+struct kdop_half
+{
+    float value;
+
+    kdop_half() = default;
+    kdop_half(float f): value(round_to_half(f)) {}
+    explicit operator float() const { return value; }
+};
+inline kdop_half operator+(kdop_half a, kdop_half b) { return a.value + b.value; }
+inline kdop_half operator-(kdop_half a, kdop_half b) { return a.value - b.value; }
+inline kdop_half operator*(kdop_half a, kdop_half b) { return a.value * b.value; }
+inline kdop_half operator/(kdop_half a, kdop_half b) { return a.value / b.value; }
+inline kdop_half operator-(kdop_half a) { return -a.value; }
+inline bool operator<(kdop_half a, kdop_half b) { return a.value < b.value; }
+inline bool operator>(kdop_half a, kdop_half b) { return a.value > b.value; }
+inline bool operator<=(kdop_half a, kdop_half b) { return a.value <= b.value; }
+#endif
+
+// Just enough of a vector type for kdop_clipping(), as glm doesn't do fp16.
+template<typename T>
+struct clip_vec3
+{
+    T x, y, z;
+
+    clip_vec3() = default;
+    clip_vec3(vec3 v): x(T(v.x)), y(T(v.y)), z(T(v.z)) {}
+    clip_vec3(T x, T y, T z): x(x), y(y), z(z) {}
+    vec3 to_vec3() const { return vec3(float(x), float(y), float(z)); }
+};
+
+template<typename T>
+clip_vec3<T> operator-(const clip_vec3<T>& a, const clip_vec3<T>& b)
+{
+    return clip_vec3<T>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template<typename T>
+clip_vec3<T> operator+(const clip_vec3<T>& a, const clip_vec3<T>& b)
+{
+    return clip_vec3<T>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+template<typename T>
+clip_vec3<T> operator*(T s, const clip_vec3<T>& v)
+{
+    return clip_vec3<T>(s * v.x, s * v.y, s * v.z);
+}
+
+template<typename T>
+T dot(const clip_vec3<T>& a, const clip_vec3<T>& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template<typename T>
+T clip_min(T a, T b) { return b < a ? b : a; }
+
+template<typename T>
+T clip_max(T a, T b) { return a < b ? b : a; }
+
+// Same as kdop_clipping() in kdop_clipping.glsl, with all math done in T.
+// If 'hit' is given, it tells whether the ray hit the k-DOP; otherwise, the
+// current color is returned as-is.
+template<typename T>
+vec3 kdop_clipping(
+    vec3 cur_color_in,
+    vec3 prev_color_in,
+    const vec3* colors_in,
+    size_t neighborhood_size,
+    const vec3* axes,
+    size_t axis_count,
+    bool* hit = nullptr
+){
+    const T epsilon = T(1e-5f);
+    const T zero = T(0.0f);
+    const T one = T(1.0f);
+
+    clip_vec3<T> cur_color(cur_color_in);
+    clip_vec3<T> prev_color(prev_color_in);
+    clip_vec3<T> colors[32];
+    for(size_t n = 0; n < neighborhood_size; ++n)
+        colors[n] = clip_vec3<T>(colors_in[n]);
+
+    clip_vec3<T> dir = prev_color - cur_color;
+    T near = T(-1e9f), far = T(1e9f);
+    for(size_t a = 0; a < axis_count; ++a)
+    {
+        clip_vec3<T> axis(axes[a]);
+        T extent_x = T(1e9f), extent_y = T(-1e9f);
+        for(size_t n = 0; n < neighborhood_size; ++n)
+        {
+            T t = dot(colors[n], axis);
+            extent_x = clip_min(t, extent_x);
+            extent_y = clip_max(t, extent_y);
+        }
+        extent_x = extent_x - epsilon;
+        extent_y = extent_y + epsilon;
+
+        T proj_pos = dot(cur_color, axis);
+        T inv_dir = one / dot(dir, axis);
+        T t0 = (extent_x - proj_pos) * inv_dir;
+        T t1 = (extent_y - proj_pos) * inv_dir;
+
+        near = clip_max(near, clip_min(t0, t1));
+        far = clip_min(far, clip_max(t0, t1));
+    }
+    bool is_hit = near <= far && (zero < near || zero < far);
+    if(hit) *hit = is_hit;
+    if(is_hit)
+    {
+        T t = zero < near ? near : far;
+        t = clip_min(clip_max(t, zero), one);
+        return (cur_color + t * dir).to_vec3();
+    }
+    return cur_color.to_vec3();
+}
+
+#endif
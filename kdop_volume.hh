@@ -39,16 +39,23 @@
 // Still, it's faster than CGAL with reasonable axis counts, and doesn't crash
 // like CGAL and doesn't slow down compile times to several minutes like CGAL.
 //
-// It should also be pretty easy to calculate the area too, if you want that.
-// Near the end of calc_kdop_volume(), after vertices have been de-duplicated,
-// si.vertices contains a clockwise list of vertices for each face. You can form
-// a triangle fan from that and then calculate the area from that. Mesh
-// generation should also be similarly easy.
+// Surface area comes from the same faces: near the end of calc_kdop_measures(),
+// after vertices have been de-duplicated, si.vertices contains a clockwise list
+// of vertices for each face, and the area is that of a triangle fan over it.
+// Mesh generation should also be similarly easy.
+//
+// When evaluating many k-DOPs that differ only slightly (e.g. late in the
+// optimization, where axes barely move), pass a kdop_topology along. It
+// remembers which three planes meet at each vertex, so that the next call can
+// just solve those vertices directly and check that they are still valid,
+// instead of redoing the whole O(n^3) search. If the check fails, the full
+// search is done and the topology is updated.
 #ifndef KDOP_VOLUME_HH
 #define KDOP_VOLUME_HH
 #include <glm/glm.hpp>
 #include <vector>
 #include <algorithm>
+#include <unordered_map>
 using namespace glm;
 
 inline std::pair<double, double> kdop_trace_range(
@@ -126,11 +133,292 @@ inline double signed_angle(dvec3 p, dvec3 pivot, const dmat3& tbn)
     return atan2(dot(tbn[0], delta), dot(tbn[1], delta));
 }
 
-inline double calc_kdop_volume(
+// Combinatorial structure of a k-DOP. Sides are indexed as axis*2+high, like
+// in calc_kdop_volume().
+// The topology and polynomial fast paths use fixed-size arrays, so they only
+// support up to this many axes; larger k-DOPs always take the full
+// calculation. Each face has at most 2 * (axis_count - 1) vertices, one for
+// each side of every other axis, which stays well below
+// kdop_max_face_vertices.
+constexpr size_t kdop_max_axis_count = 32;
+constexpr int kdop_max_face_vertices = 128;
+
+struct kdop_topology
+{
+    // The three sides meeting at each vertex.
+    std::vector<ivec3> vertex_sides;
+    // Vertex indices of side i are
+    // face_vertices[face_offsets[i]] ... face_vertices[face_offsets[i+1]-1],
+    // in winding order.
+    std::vector<int> face_offsets;
+    std::vector<int> face_vertices;
+    // When more than three planes meet at a vertex, vertex_sides has the
+    // best-conditioned triple, and the rest are listed here as
+    // (vertex, side) pairs. This is common with color neighborhoods, where
+    // several extents can come from the same color.
+    std::vector<ivec2> extra_sides;
+    // Scratch space for vertex positions, to avoid reallocation.
+    std::vector<dvec3> vertices;
+
+    // Degenerate (flat) k-DOPs have no trackable topology, so this can be
+    // false even after a full calculation.
+    bool valid() const { return vertex_sides.size() != 0; }
+    void clear()
+    {
+        vertex_sides.clear();
+        extra_sides.clear();
+        face_offsets.clear();
+        face_vertices.clear();
+    }
+};
+
+inline double kdop_fan_volume(
+    const dvec3* face,
+    size_t vertex_count,
+    dvec3 ref_center
+){
+    double volume = 0;
+    dvec3 ref = face[0];
+    dvec3 va = face[1];
+    for(size_t i = 2; i < vertex_count; ++i)
+    {
+        dvec3 vb = face[i];
+        dmat4 m = mat4(
+            dvec4(va, 1),
+            dvec4(vb, 1),
+            dvec4(ref, 1),
+            dvec4(ref_center, 1)
+        );
+        volume += abs(determinant(m))/6;
+        va = vb;
+    }
+    return volume;
+}
+
+inline double kdop_fan_area(const dvec3* face, size_t vertex_count)
+{
+    dvec3 ref = face[0];
+    dvec3 sum = dvec3(0);
+    for(size_t i = 2; i < vertex_count; ++i)
+        sum += cross(face[i-1] - ref, face[i] - ref);
+    return length(sum) * 0.5;
+}
+
+inline double kdop_side_offset(const vec2* ranges, int side)
+{
+    return ranges[side>>1][side&1];
+}
+
+// Checks that the vertices in topology.vertices still form the k-DOP.
+inline bool check_kdop_topology(
     size_t axis_count,
     const vec3* axes,
-    const vec2* ranges
+    const vec2* ranges,
+    const kdop_topology& topology,
+    double epsilon
+){
+    // A vertex outside of the k-DOP means that some plane has started
+    // cutting it off, i.e. the topology has changed.
+    for(dvec3 v: topology.vertices)
+    {
+        if(kdop_distance(v, axis_count, axes, ranges) >= epsilon)
+            return false;
+    }
+
+    // Planes that met at a vertex must still do so.
+    for(ivec2 vs: topology.extra_sides)
+    {
+        dvec3 v = topology.vertices[vs.x];
+        double d = dot(v, dvec3(axes[vs.y>>1])) - kdop_side_offset(ranges, vs.y);
+        if(abs(d) >= epsilon)
+            return false;
+    }
+
+    // calc_kdop_measures() sorts face vertices clockwise around the axis. If
+    // any triangle of the fan turns the other way, vertices have swapped
+    // places.
+    for(size_t side = 0; side+1 < topology.face_offsets.size(); ++side)
+    {
+        int begin = topology.face_offsets[side];
+        int end = topology.face_offsets[side+1];
+        if(end - begin < 3) continue;
+        dvec3 normal = axes[side>>1];
+        dvec3 ref = topology.vertices[topology.face_vertices[begin]];
+        for(int i = begin+1; i+1 < end; ++i)
+        {
+            dvec3 va = topology.vertices[topology.face_vertices[i]];
+            dvec3 vb = topology.vertices[topology.face_vertices[i+1]];
+            if(dot(cross(va - ref, vb - ref), normal) > epsilon * epsilon)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Solves the vertices of the given topology for new axes and ranges. Returns
+// false if the topology no longer matches the k-DOP.
+inline bool solve_kdop_topology(
+    size_t axis_count,
+    const vec3* axes,
+    const vec2* ranges,
+    kdop_topology& topology,
+    double epsilon
 ){
+    topology.vertices.resize(topology.vertex_sides.size());
+    for(size_t i = 0; i < topology.vertex_sides.size(); ++i)
+    {
+        ivec3 s = topology.vertex_sides[i];
+        dvec3 n1 = axes[s.x>>1];
+        dvec3 n2 = axes[s.y>>1];
+        dvec3 n3 = axes[s.z>>1];
+        dvec3 c23 = cross(n2, n3);
+        double det = dot(n1, c23);
+        if(abs(det) < 1e-9) return false;
+
+        topology.vertices[i] = (
+            kdop_side_offset(ranges, s.x) * c23 +
+            kdop_side_offset(ranges, s.y) * cross(n3, n1) +
+            kdop_side_offset(ranges, s.z) * cross(n1, n2)
+        ) / det;
+    }
+    return check_kdop_topology(axis_count, axes, ranges, topology, epsilon);
+}
+
+inline double kdop_topology_volume(const kdop_topology& topology)
+{
+    if(topology.vertices.size() == 0) return 0;
+    dvec3 ref_center = topology.vertices[0];
+    dvec3 face[128];
+    double total_volume = 0;
+    for(size_t side = 0; side+1 < topology.face_offsets.size(); ++side)
+    {
+        int begin = topology.face_offsets[side];
+        int end = topology.face_offsets[side+1];
+        if(end - begin < 3) continue;
+        for(int i = begin; i < end; ++i)
+            face[i-begin] = topology.vertices[topology.face_vertices[i]];
+        total_volume += kdop_fan_volume(face, end-begin, ref_center);
+    }
+    return total_volume;
+}
+
+inline double kdop_topology_area(const kdop_topology& topology)
+{
+    dvec3 face[128];
+    double total_area = 0;
+    for(size_t side = 0; side+1 < topology.face_offsets.size(); ++side)
+    {
+        int begin = topology.face_offsets[side];
+        int end = topology.face_offsets[side+1];
+        if(end - begin < 3) continue;
+        for(int i = begin; i < end; ++i)
+            face[i-begin] = topology.vertices[topology.face_vertices[i]];
+        total_area += kdop_fan_area(face, end-begin);
+    }
+    return total_area;
+}
+
+struct kdop_side_info
+{
+    std::vector<dvec3> vertices;
+};
+
+// Extracts the topology from the de-duplicated, sorted side vertices of
+// calc_kdop_measures().
+inline void build_kdop_topology(
+    const vec3* axes,
+    const std::vector<kdop_side_info>& sides,
+    kdop_topology& topology,
+    double epsilon
+){
+    topology.clear();
+    topology.vertices.clear();
+    if(sides.size() > kdop_max_axis_count * 2)
+        return;
+    std::vector<std::vector<int>> vertex_side_lists;
+    topology.face_offsets.push_back(0);
+    for(int i = 0; i < sides.size(); ++i)
+    {
+        const kdop_side_info& si = sides[i];
+        if(si.vertices.size() > kdop_max_face_vertices)
+        { // Shouldn't happen, but the face wouldn't fit in the fast paths.
+            topology.clear();
+            return;
+        }
+        if(si.vertices.size() > 2)
+        {
+            for(dvec3 v: si.vertices)
+            {
+                int index = 0;
+                for(; index < topology.vertices.size(); ++index)
+                {
+                    dvec3 delta = topology.vertices[index] - v;
+                    if(dot(delta, delta) < epsilon * epsilon)
+                        break;
+                }
+                if(index == topology.vertices.size())
+                {
+                    topology.vertices.push_back(v);
+                    vertex_side_lists.emplace_back();
+                }
+                vertex_side_lists[index].push_back(i);
+                topology.face_vertices.push_back(index);
+            }
+        }
+        topology.face_offsets.push_back(topology.face_vertices.size());
+    }
+
+    for(int v = 0; v < vertex_side_lists.size(); ++v)
+    {
+        const std::vector<int>& list = vertex_side_lists[v];
+        ivec3 best_sides = ivec3(-1);
+        double best_det = 1e-9;
+        for(int i = 0; i < list.size(); ++i)
+        for(int j = i+1; j < list.size(); ++j)
+        for(int k = j+1; k < list.size(); ++k)
+        {
+            double det = abs(dot(
+                dvec3(axes[list[i]>>1]),
+                cross(dvec3(axes[list[j]>>1]), dvec3(axes[list[k]>>1]))
+            ));
+            if(det > best_det)
+            {
+                best_det = det;
+                best_sides = ivec3(list[i], list[j], list[k]);
+            }
+        }
+
+        if(best_sides.x < 0)
+        { // Vertex isn't properly defined by its planes, can't track that.
+            topology.clear();
+            return;
+        }
+
+        topology.vertex_sides.push_back(best_sides);
+        for(int side: list)
+        {
+            if(side != best_sides.x && side != best_sides.y && side != best_sides.z)
+                topology.extra_sides.push_back(ivec2(v, side));
+        }
+    }
+}
+
+struct kdop_measures
+{
+    double volume = 0;
+    double surface_area = 0;
+};
+
+// Surface area is only calculated if 'want_area' is set. Flat k-DOPs get the
+// area of both sides, which is what a ray would see.
+inline kdop_measures calc_kdop_measures(
+    size_t axis_count,
+    const vec3* axes,
+    const vec2* ranges,
+    kdop_topology* topology = nullptr,
+    bool want_area = false
+){
+    kdop_measures measures;
     // Algorithm:
     //
     // Find all edges between planes. (N^2)
@@ -143,11 +431,19 @@ inline double calc_kdop_volume(
     //  compute volume based on tetrahedrons to volume midpoint.
 
     constexpr double epsilon = 1e-5f;
-    struct side_info
+    if(topology && topology->valid() && axis_count <= kdop_max_axis_count)
     {
-        std::vector<dvec3> vertices;
-    };
-    std::vector<side_info> sides(axis_count * 2);
+        if(solve_kdop_topology(axis_count, axes, ranges, *topology, epsilon))
+        {
+            measures.volume = kdop_topology_volume(*topology);
+            if(want_area)
+                measures.surface_area = kdop_topology_area(*topology);
+            return measures;
+        }
+        topology->clear();
+    }
+
+    std::vector<kdop_side_info> sides(axis_count * 2);
 
     for(int a = 0; a < axis_count; ++a)
     for(int b = 0; b < axis_count; ++b)
@@ -176,8 +472,8 @@ inline double calc_kdop_volume(
             double c2 = (h2 - h1 * d) * inv;
             dvec3 point = c1 * a_axis + c2 * b_axis;
 
-            side_info& a_info = sides[a_side];
-            side_info& b_info = sides[b_side];
+            kdop_side_info& a_info = sides[a_side];
+            kdop_side_info& b_info = sides[b_side];
 
             auto hits = kdop_trace_range(
                 point, dir, axis_count, axes, ranges, excluded
@@ -209,7 +505,7 @@ inline double calc_kdop_volume(
 
     dvec3 ref_center = dvec3(0);
     // Find first vertex that exists.
-    for(side_info& si: sides)
+    for(kdop_side_info& si: sides)
     {
         if(si.vertices.size() > 2)
         {
@@ -218,11 +514,10 @@ inline double calc_kdop_volume(
         }
     }
 
-    double total_volume = 0;
     for(int i = 0; i < sides.size(); ++i)
     {
         dvec3 axis = axes[i/2];
-        side_info& si = sides[i];
+        kdop_side_info& si = sides[i];
         if(si.vertices.size() <= 2) continue;
 
         dmat3 tbn = create_tangent_space(axis);
@@ -263,29 +558,277 @@ inline double calc_kdop_volume(
 
         //printf("Axis: %f, %f, %f\n", axis.x, axis.y, axis.z);
 
-        dvec3 ref2 = si.vertices[0]; // May have changed after sorting.
-        // Iterate over unique points.
-        dvec3 va = si.vertices[1];
-        //printf("\tPoint: %f, %f, %f (%f)\n", ref2.x, ref2.y, ref2.z, signed_angle(ref2, ref, tbn));
-        //printf("\tPoint: %f, %f, %f (%f)\n", va.x, va.y, va.z, signed_angle(va, ref, tbn));
-        for(int i = 2; i < si.vertices.size(); ++i)
+        measures.volume += kdop_fan_volume(
+            si.vertices.data(), si.vertices.size(), ref_center
+        );
+        if(want_area)
         {
-            dvec3 vb = si.vertices[i];
-            //printf("\tPoint: %f, %f, %f (%f)\n", vb.x, vb.y, vb.z, signed_angle(vb, ref, tbn));
-            dmat4 m = mat4(
-                dvec4(va, 1),
-                dvec4(vb, 1),
-                dvec4(ref2, 1),
-                dvec4(ref_center, 1)
+            measures.surface_area += kdop_fan_area(
+                si.vertices.data(), si.vertices.size()
             );
-            double volume = abs(determinant(m))/6;
-            //printf("%f\n", volume);
-            total_volume += volume;
-            va = vb;
         }
     }
-    return total_volume;
+
+    if(topology)
+        build_kdop_topology(axes, sides, *topology, epsilon);
+
+    return measures;
+}
+
+inline double calc_kdop_volume(
+    size_t axis_count,
+    const vec3* axes,
+    const vec2* ranges,
+    kdop_topology* topology = nullptr
+){
+    return calc_kdop_measures(axis_count, axes, ranges, topology).volume;
+}
+
+inline double calc_kdop_surface_area(
+    size_t axis_count,
+    const vec3* axes,
+    const vec2* ranges,
+    kdop_topology* topology = nullptr
+){
+    return calc_kdop_measures(axis_count, axes, ranges, topology, true).surface_area;
+}
+
+// For a fixed axis set and topology, each vertex is a linear function of the
+// side offsets, so the volume is a cubic polynomial of them. This stores that
+// polynomial, along with the linear vertex functions for checking whether a
+// k-DOP has the same topology.
+struct kdop_volume_polynomial
+{
+    struct term
+    {
+        int sides[3];
+        double coefficient;
+    };
+
+    kdop_topology topology;
+    // Three per vertex, multiplied by the offsets of the vertex's sides.
+    std::vector<dvec3> vertex_coefficients;
+    std::vector<term> terms;
+};
+
+inline bool build_kdop_volume_polynomial(
+    const vec3* axes,
+    const kdop_topology& topology,
+    kdop_volume_polynomial& poly
+){
+    poly.topology = topology;
+    poly.vertex_coefficients.resize(topology.vertex_sides.size() * 3);
+    for(size_t i = 0; i < topology.vertex_sides.size(); ++i)
+    {
+        ivec3 s = topology.vertex_sides[i];
+        dvec3 n1 = axes[s.x>>1];
+        dvec3 n2 = axes[s.y>>1];
+        dvec3 n3 = axes[s.z>>1];
+        double det = dot(n1, cross(n2, n3));
+        if(abs(det) < 1e-9) return false;
+        poly.vertex_coefficients[i*3+0] = cross(n2, n3) / det;
+        poly.vertex_coefficients[i*3+1] = cross(n3, n1) / det;
+        poly.vertex_coefficients[i*3+2] = cross(n1, n2) / det;
+    }
+
+    // Sum of signed tetrahedra from the origin, with each face wound
+    // outwards. Each tetrahedron is a trilinear function of its three vertices,
+    // giving 27 terms per triangle.
+    std::unordered_map<int, double> terms;
+    for(size_t side = 0; side+1 < topology.face_offsets.size(); ++side)
+    {
+        int begin = topology.face_offsets[side];
+        int end = topology.face_offsets[side+1];
+        if(end - begin < 3) continue;
+
+        // Faces are wound clockwise around the axis, which is outwards only
+        // for the low side. The winding can't be determined from the vertex
+        // positions, as the face may well have zero area in the k-DOP that
+        // the topology came from.
+        double sign = (side&1) ? -1 : 1;
+
+        int v0 = topology.face_vertices[begin];
+        for(int i = begin+1; i+1 < end; ++i)
+        {
+            int v1 = topology.face_vertices[i];
+            int v2 = topology.face_vertices[i+1];
+            for(int p = 0; p < 3; ++p)
+            for(int q = 0; q < 3; ++q)
+            for(int r = 0; r < 3; ++r)
+            {
+                double coefficient = sign / 6 * dot(
+                    poly.vertex_coefficients[v0*3+p],
+                    cross(
+                        poly.vertex_coefficients[v1*3+q],
+                        poly.vertex_coefficients[v2*3+r]
+                    )
+                );
+                int key[3] = {
+                    topology.vertex_sides[v0][p],
+                    topology.vertex_sides[v1][q],
+                    topology.vertex_sides[v2][r]
+                };
+                std::sort(key, key+3);
+                terms[(key[0] << 16) | (key[1] << 8) | key[2]] += coefficient;
+            }
+        }
+    }
+
+    poly.terms.clear();
+    for(auto [key, coefficient]: terms)
+    {
+        if(abs(coefficient) < 1e-12) continue;
+        poly.terms.push_back({
+            {key >> 16, (key >> 8) & 0xFF, key & 0xFF}, coefficient
+        });
+    }
+    return true;
+}
+
+// Returns a negative value if the k-DOP doesn't have the polynomial's
+// topology.
+inline double eval_kdop_volume_polynomial(
+    size_t axis_count,
+    const vec3* axes,
+    const vec2* ranges,
+    kdop_volume_polynomial& poly,
+    double epsilon
+){
+    kdop_topology& topology = poly.topology;
+    for(size_t i = 0; i < topology.vertex_sides.size(); ++i)
+    {
+        ivec3 s = topology.vertex_sides[i];
+        topology.vertices[i] =
+            kdop_side_offset(ranges, s.x) * poly.vertex_coefficients[i*3+0] +
+            kdop_side_offset(ranges, s.y) * poly.vertex_coefficients[i*3+1] +
+            kdop_side_offset(ranges, s.z) * poly.vertex_coefficients[i*3+2];
+    }
+    if(!check_kdop_topology(axis_count, axes, ranges, topology, epsilon))
+        return -1;
+
+    // Volume doesn't depend on position, so the polynomial is evaluated with
+    // the k-DOP moved to the origin. Otherwise, the large terms of colors far
+    // from the origin would cancel out catastrophically.
+    dvec3 origin = topology.vertices[0];
+    double offsets[kdop_max_axis_count * 2];
+    for(size_t a = 0; a < axis_count; ++a)
+    {
+        double shift = dot(dvec3(axes[a]), origin);
+        offsets[a*2+0] = ranges[a].x - shift;
+        offsets[a*2+1] = ranges[a].y - shift;
+    }
+
+    double volume = 0;
+    for(const kdop_volume_polynomial::term& t: poly.terms)
+    {
+        volume += t.coefficient *
+            offsets[t.sides[0]] * offsets[t.sides[1]] * offsets[t.sides[2]];
+    }
+    return abs(volume);
 }
 
+// Calculates volumes of many k-DOPs sharing the same axes. Volume polynomials
+// are built for each topology as it is first encountered, after which k-DOPs
+// with the same topology only need the polynomial to be evaluated. Not
+// thread-safe, use one per thread.
+class kdop_polynomial_cache
+{
+public:
+    // Only this many of the most common topologies are tried before falling
+    // back to calc_kdop_volume().
+    static constexpr size_t max_attempts = 4;
+
+    kdop_polynomial_cache(size_t axis_count, const vec3* axes)
+    : axis_count(axis_count), axes(axes)
+    {
+    }
+
+    double calc_volume(const vec2* ranges)
+    {
+        constexpr double epsilon = 1e-5f;
+        // If topologies rarely repeat, trying the polynomials is just
+        // overhead.
+        calls++;
+        if(axis_count > kdop_max_axis_count || (calls > 256 && hits * 4 < calls))
+            return calc_kdop_volume(axis_count, axes, ranges);
+
+        size_t attempts = std::min(polynomials.size(), max_attempts);
+        for(size_t i = 0; i < attempts; ++i)
+        {
+            double volume = eval_kdop_volume_polynomial(
+                axis_count, axes, ranges, polynomials[i], epsilon
+            );
+            if(volume < 0) continue;
+
+            // Move towards the front, so that common topologies are tried
+            // first.
+            if(i > 0) std::swap(polynomials[i], polynomials[i-1]);
+            hits++;
+            return volume;
+        }
+
+        double volume = calc_kdop_volume(axis_count, axes, ranges, &scratch);
+        if(scratch.valid())
+        {
+            // Vertex order depends on where the full calculation started, so
+            // sort to make the key unique.
+            std::vector<std::vector<int>> vertex_keys(scratch.vertex_sides.size());
+            for(size_t i = 0; i < scratch.vertex_sides.size(); ++i)
+            {
+                ivec3 s = scratch.vertex_sides[i];
+                vertex_keys[i] = {s.x, s.y, s.z};
+            }
+            for(ivec2 vs: scratch.extra_sides)
+                vertex_keys[vs.x].push_back(vs.y);
+            for(std::vector<int>& vk: vertex_keys)
+                std::sort(vk.begin(), vk.end());
+            std::sort(vertex_keys.begin(), vertex_keys.end());
+
+            std::vector<int> key;
+            for(const std::vector<int>& vk: vertex_keys)
+            {
+                key.insert(key.end(), vk.begin(), vk.end());
+                key.push_back(-1);
+            }
+
+            // Building the polynomial costs much more than a single full
+            // calculation, so only do it for topologies that recur.
+            if(++seen_topologies[std::move(key)] == 2)
+            {
+                kdop_volume_polynomial poly;
+                if(build_kdop_volume_polynomial(axes, scratch, poly))
+                    polynomials.push_back(std::move(poly));
+            }
+        }
+        return volume;
+    }
+
+    size_t topology_count() const { return polynomials.size(); }
+
+private:
+    struct key_hash
+    {
+        size_t operator()(const std::vector<int>& key) const
+        {
+            // FNV-1a
+            size_t hash = 14695981039346656037ull;
+            for(int k: key)
+            {
+                hash ^= size_t(k);
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    };
+
+    size_t axis_count;
+    const vec3* axes;
+    size_t calls = 0;
+    size_t hits = 0;
+    kdop_topology scratch;
+    std::unordered_map<std::vector<int>, int, key_hash> seen_topologies;
+    std::vector<kdop_volume_polynomial> polynomials;
+};
+
 #endif
 
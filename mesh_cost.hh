@@ -0,0 +1,267 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Cost function of the mesh optimizer: the average k-DOP surface area around
+// triangle clusters that stand in for BVH nodes. With the surface area
+// heuristic, the expected cost of tracing a ray through a BVH is proportional
+// to the summed surface areas of its nodes, so lowering this average lowers
+// the traversal cost of k-DOP BVHs built with the same axes.
+#ifndef KDOP_MESH_COST_HH
+#define KDOP_MESH_COST_HH
+#include <glm/glm.hpp>
+#include "kdop_volume.hh"
+#include "optimizer.hh"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace glm;
+
+struct triangle_mesh
+{
+    std::vector<vec3> vertices;
+    std::vector<uvec3> triangles;
+};
+
+// Reads one line of any length, without the newline. Returns false at the end
+// of the file.
+inline bool read_line(FILE* f, std::string& line)
+{
+    char chunk[4096];
+    line.clear();
+    while(fgets(chunk, sizeof(chunk), f))
+    {
+        size_t len = strlen(chunk);
+        if(len > 0 && chunk[len-1] == '\n')
+        {
+            line.append(chunk, len-1);
+            return true;
+        }
+        line.append(chunk, len);
+    }
+    return !line.empty();
+}
+
+// Reads vertex positions and faces from a Wavefront OBJ file, ignoring
+// everything else. Polygons are triangulated as fans.
+inline bool load_obj(const char* path, triangle_mesh& mesh)
+{
+    FILE* f = fopen(path, "r");
+    if(!f) return false;
+
+    std::string line;
+    std::vector<uint32_t> face;
+    bool success = true;
+    while(success && read_line(f, line))
+    {
+        if(line[0] == 'v' && line[1] == ' ')
+        {
+            vec3 v;
+            success = sscanf(line.c_str()+2, "%f %f %f", &v.x, &v.y, &v.z) == 3;
+            mesh.vertices.push_back(v);
+        }
+        else if(line[0] == 'f' && line[1] == ' ')
+        {
+            face.clear();
+            char* cur = line.data()+2;
+            for(;;)
+            {
+                char* end = nullptr;
+                long index = strtol(cur, &end, 10);
+                if(end == cur) break;
+                // Negative indices are relative to the end.
+                if(index < 0) index += mesh.vertices.size();
+                else index -= 1;
+                if(index < 0 || size_t(index) >= mesh.vertices.size())
+                {
+                    success = false;
+                    break;
+                }
+                face.push_back(index);
+                // Skip texture coordinate and normal indices.
+                cur = end;
+                while(*cur && *cur != ' ' && *cur != '\t') ++cur;
+            }
+            for(size_t i = 2; i < face.size(); ++i)
+                mesh.triangles.push_back(uvec3(face[0], face[i-1], face[i]));
+        }
+    }
+    fclose(f);
+    return success;
+}
+
+// Spreads the low 10 bits of 'x' to every third bit.
+inline uint32_t expand_morton_bits(uint32_t x)
+{
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Triangles are put in Morton order, like in a linear BVH, and each cluster is
+// an aligned power-of-two range of them, i.e. a node of that BVH.
+struct triangle_cluster_dataset
+{
+    // Three corners per triangle.
+    std::vector<vec3> corners;
+    // First and one-past-last triangle of each cluster.
+    std::vector<uvec2> clusters;
+    // Areas are divided by the surface area of the mesh's bounding box, which
+    // also is the area of the root node of an AABB BVH.
+    float area_scale = 1.0f;
+
+    size_t size() const { return clusters.size(); }
+};
+
+// Samples 'count' clusters such that every node of the implicit BVH is
+// equally likely, like the sum in the surface area heuristic. 'leaf_size' is
+// the triangle count of the smallest clusters.
+inline void sample_triangle_clusters(
+    triangle_cluster_dataset& dataset,
+    const triangle_mesh& mesh,
+    uint seed,
+    size_t count,
+    size_t leaf_size = 4
+){
+    size_t triangle_count = mesh.triangles.size();
+    if(triangle_count == 0) return;
+
+    vec3 bb_min = vec3(INFINITY);
+    vec3 bb_max = vec3(-INFINITY);
+    for(uvec3 t: mesh.triangles)
+    for(int i = 0; i < 3; ++i)
+    {
+        bb_min = min(bb_min, mesh.vertices[t[i]]);
+        bb_max = max(bb_max, mesh.vertices[t[i]]);
+    }
+    vec3 size = bb_max - bb_min;
+    // The k-DOP calculation uses absolute epsilons, so the mesh is fit into
+    // [-1, 1].
+    vec3 center = (bb_min + bb_max) * 0.5f;
+    float max_size = std::max(size.x, std::max(size.y, size.z));
+    float mesh_scale = max_size > 0 ? 2.0f / max_size : 1.0f;
+    vec3 scaled_size = size * mesh_scale;
+    float root_area = 2.0f * (
+        scaled_size.x * scaled_size.y +
+        scaled_size.y * scaled_size.z +
+        scaled_size.z * scaled_size.x
+    );
+    dataset.area_scale = root_area > 0 ? 1.0f / root_area : 1.0f;
+
+    std::vector<std::pair<uint32_t, uint32_t>> order(triangle_count);
+    vec3 inv_size = 1023.0f / max(size, vec3(1e-20f));
+    for(size_t i = 0; i < triangle_count; ++i)
+    {
+        uvec3 t = mesh.triangles[i];
+        vec3 centroid = (mesh.vertices[t.x] + mesh.vertices[t.y] + mesh.vertices[t.z]) / 3.0f;
+        uvec3 cell = uvec3(min(max((centroid - bb_min) * inv_size, vec3(0)), vec3(1023)));
+        uint32_t code =
+            expand_morton_bits(cell.x) |
+            (expand_morton_bits(cell.y) << 1) |
+            (expand_morton_bits(cell.z) << 2);
+        order[i] = {code, uint32_t(i)};
+    }
+    std::sort(order.begin(), order.end());
+
+    dataset.corners.resize(triangle_count * 3);
+    for(size_t i = 0; i < triangle_count; ++i)
+    {
+        uvec3 t = mesh.triangles[order[i].second];
+        for(int j = 0; j < 3; ++j)
+            dataset.corners[i*3+j] = (mesh.vertices[t[j]] - center) * mesh_scale;
+    }
+
+    // Node counts halve on each level, so leaves dominate like in a real BVH.
+    std::vector<size_t> level_sizes;
+    std::vector<double> level_cdf;
+    double total_nodes = 0;
+    for(size_t s = std::min(leaf_size, triangle_count);; s *= 2)
+    {
+        level_sizes.push_back(s);
+        total_nodes += (triangle_count + s - 1) / s;
+        level_cdf.push_back(total_nodes);
+        if(s >= triangle_count) break;
+    }
+
+    for(size_t a = 0; a < count; ++a)
+    {
+        double u = generate_uniform_random(seed) * total_nodes;
+        size_t level = std::upper_bound(level_cdf.begin(), level_cdf.end(), u) - level_cdf.begin();
+        level = std::min(level, level_sizes.size()-1);
+        size_t s = level_sizes[level];
+        size_t node_count = (triangle_count + s - 1) / s;
+        size_t node = std::min(size_t(generate_uniform_random(seed) * node_count), node_count-1);
+        size_t begin = node * s;
+        size_t end = std::min(begin + s, triangle_count);
+        dataset.clusters.push_back(uvec2(begin, end));
+    }
+}
+
+// Keeps the topology of each cluster's k-DOP between calls, so that small
+// steps late in the optimization mostly avoid the full k-DOP calculation.
+class mesh_area_cost
+{
+public:
+    mesh_area_cost(const triangle_cluster_dataset& dataset)
+    :   dataset(dataset), topologies(dataset.size())
+    {
+    }
+
+    float evaluate(const vec3* axes, size_t axis_count)
+    {
+        const size_t count = dataset.size();
+        double sum_area = 0;
+
+        #pragma omp parallel for reduction(+:sum_area) schedule(dynamic, 16)
+        for(size_t c = 0; c < count; ++c)
+        {
+            uvec2 cluster = dataset.clusters[c];
+            vec2 axis_extents[kdop_max_axis_count];
+            for(size_t i = 0; i < axis_count; ++i)
+                axis_extents[i] = vec2(1e9, -1e9);
+
+            for(size_t i = cluster.x * 3; i < cluster.y * 3; ++i)
+            {
+                vec3 p = dataset.corners[i];
+                for(size_t j = 0; j < axis_count; ++j)
+                {
+                    auto& pair = axis_extents[j];
+                    float d = dot(p, axes[j]);
+                    pair.x = std::min(pair.x, d);
+                    pair.y = std::max(pair.y, d);
+                }
+            }
+            sum_area += calc_kdop_surface_area(
+                axis_count, axes, axis_extents, &topologies[c]
+            );
+        }
+
+        return sum_area / count * dataset.area_scale;
+    }
+
+private:
+    const triangle_cluster_dataset& dataset;
+    std::vector<kdop_topology> topologies;
+};
+
+#endif
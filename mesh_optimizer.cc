@@ -0,0 +1,147 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+#include <glm/glm.hpp>
+#include "kdop_volume.hh"
+#include "optimizer.hh"
+#include "bayesian_optimizer.hh"
+#include "mesh_cost.hh"
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <clocale>
+#include <cstring>
+
+using namespace glm;
+
+int main(int argc, char** argv)
+{
+    size_t metropolis_evaluations = 0;
+    size_t bayesian_evaluations = 0;
+    std::vector<const char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--metropolis") == 0 && i+1 < argc)
+            metropolis_evaluations = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--bayesian") == 0 && i+1 < argc)
+            bayesian_evaluations = strtoull(argv[++i], nullptr, 10);
+        else args.push_back(argv[i]);
+    }
+
+    if(args.size() < 2)
+    {
+        printf("Usage: %s [options] <mesh.obj> <axis_count> [forced axes...]\n", argv[0]);
+        printf("Options:\n");
+        printf("    --metropolis <n>     Use Metropolis annealing scheduled for and capped at n evaluations\n");
+        printf("    --bayesian <n>       Use Gaussian process Bayesian optimization for n evaluations\n");
+        return 1;
+    }
+
+    // Make atoi / atof behave predictably
+    setlocale(LC_ALL, "C");
+
+    const char* filename = args[0];
+    int axis_count = atoi(args[1]);
+    if(axis_count < 3 || axis_count > int(kdop_max_axis_count))
+    {
+        fprintf(stderr, "Axis count must be between 3 and %zu\n", kdop_max_axis_count);
+        return 1;
+    }
+
+    std::vector<vec3> best_axes(axis_count, vec3(0));
+    uint seed = 0;
+
+    int locked_axes = 0;
+    for(int i = 0; i < int(args.size())-2; ++i)
+    {
+        int component_index = i%3;
+        if(component_index == 0)
+            locked_axes++;
+        best_axes[locked_axes-1][component_index] = atof(args[2+i]);
+    }
+    for(int i = 0; i < locked_axes; ++i)
+        best_axes[i] = normalize(best_axes[i]);
+    for(int i = locked_axes; i < axis_count; ++i)
+        best_axes[i] = sample_sphere(seed);
+
+    if(bayesian_evaluations > 0 && axis_count - locked_axes > bayesian_max_free_axes)
+    {
+        fprintf(
+            stderr, "--bayesian supports at most %d axes besides the forced ones\n",
+            bayesian_max_free_axes
+        );
+        return 1;
+    }
+
+    triangle_mesh mesh;
+    if(!load_obj(filename, mesh) || mesh.triangles.size() == 0)
+    {
+        fprintf(stderr, "Failed to load %s\n", filename);
+        return 1;
+    }
+    triangle_cluster_dataset dataset;
+    sample_triangle_clusters(dataset, mesh, 0, 10000);
+    printf(
+        "Sampled %zu clusters from %zu triangles\n",
+        dataset.size(), mesh.triangles.size()
+    );
+
+    mesh_area_cost cost(dataset);
+    axis_objective objective(
+        [&](const std::vector<vec3>& axes)
+        {
+            return cost.evaluate(axes.data(), axes.size());
+        }
+    );
+
+    optimizer_result result;
+    if(bayesian_evaluations > 0)
+    {
+        bayesian_params params;
+        params.max_evaluations = bayesian_evaluations;
+        params.seed = seed;
+        params.verbosity = 2;
+        result = optimize_bayesian(best_axes, locked_axes, objective, params);
+    }
+    else if(metropolis_evaluations > 0)
+    {
+        metropolis_params params;
+        params.min_step = 1e-6f;
+        params.schedule_length = metropolis_evaluations;
+        params.seed = seed;
+        params.verbosity = 2;
+        optimizer_budget budget;
+        budget.max_evaluations = metropolis_evaluations;
+        result = optimize_metropolis(best_axes, locked_axes, objective, params, budget);
+    }
+    else
+    {
+        annealing_params params;
+        params.initial_step = 1;
+        params.min_step = 1e-6f;
+        params.patience = 100;
+        params.seed = seed;
+        params.verbosity = 2;
+        result = optimize_annealing(best_axes, locked_axes, objective, params);
+    }
+    best_axes = result.best_axes;
+
+    printf("Finished axis optimization\n");
+    for(int i = 0; i < axis_count; ++i)
+        printf("    vec3(%f, %f, %f),\n", best_axes[i].x, best_axes[i].y, best_axes[i].z);
+
+    return 0;
+}
@@ -0,0 +1,378 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Shared search logic for the axis optimizers. Front-ends (sphere_optimizer,
+// image_optimizer, optimizer_benchmark) only define the cost of an axis set;
+// everything about how new axis sets are proposed and accepted lives here, so
+// that the benchmark measures exactly what the tools run.
+#ifndef KDOP_OPTIMIZER_HH
+#define KDOP_OPTIMIZER_HH
+#include <glm/glm.hpp>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+using namespace glm;
+
+inline uint pcg(uint& seed)
+{
+    seed = seed * 747796405u + 2891336453u;
+    seed = ((seed >> ((seed >> 28) + 4)) ^ seed) * 277803737u;
+    seed ^= seed >> 22;
+    return seed;
+}
+
+inline float generate_uniform_random(uint& seed)
+{
+    return pcg(seed) * 2.3283064365386963e-10f;
+}
+
+inline vec3 sample_sphere(vec2 u)
+{
+    float cos_theta = 2.0f * u.x - 1.0f;
+    float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
+    float phi = u.y * 2.0f * M_PI;
+    return vec3(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);
+}
+
+inline vec3 sample_sphere(uint& seed)
+{
+    vec2 u;
+    u.x = generate_uniform_random(seed);
+    u.y = generate_uniform_random(seed);
+    return sample_sphere(u);
+}
+
+// Returns the cost of the given axis set; lower is better.
+typedef std::function<float(const std::vector<vec3>& axes)> axis_cost_function;
+
+struct axis_objective
+{
+    template<
+        typename F,
+        typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, axis_objective>>
+    >
+    axis_objective(F&& cost, std::function<bool()> refresh = nullptr)
+    : cost(std::forward<F>(cost)), refresh(std::move(refresh))
+    {
+    }
+
+    axis_cost_function cost;
+    // Optional, for objectives that change during the optimization, e.g. by
+    // resampling. Called before each proposal; returning true means that
+    // earlier scores are no longer comparable, so the best axes get
+    // re-scored.
+    std::function<bool()> refresh;
+};
+
+struct optimizer_progress
+{
+    size_t evaluations;
+    double seconds;
+    float best_score;
+};
+
+struct optimizer_result
+{
+    std::vector<vec3> best_axes;
+    float best_score = INFINITY;
+    size_t evaluations = 0;
+    double seconds = 0;
+    // One entry for every time the best score improved.
+    std::vector<optimizer_progress> history;
+};
+
+// Optimizers stop at their own convergence criteria or when either limit is
+// reached, whichever comes first.
+struct optimizer_budget
+{
+    size_t max_evaluations = SIZE_MAX;
+    double max_seconds = INFINITY;
+};
+
+// Counts evaluations and time, and keeps track of the best axis set seen so
+// far. All optimization modes should go through this so that their results
+// are comparable.
+class optimizer_tracker
+{
+public:
+    optimizer_tracker(
+        optimizer_result& result,
+        const optimizer_budget& budget,
+        int verbosity
+    ):  result(result), budget(budget), verbosity(verbosity),
+        start(std::chrono::steady_clock::now())
+    {
+    }
+
+    float evaluate(const axis_objective& objective, const std::vector<vec3>& axes)
+    {
+        float score = objective.cost(axes);
+        result.evaluations++;
+        result.seconds = elapsed();
+        if(score < result.best_score)
+        {
+            result.best_score = score;
+            result.best_axes = axes;
+            result.history.push_back({result.evaluations, result.seconds, score});
+            if(verbosity >= 1)
+                printf("Best so far on try %zu: %e\n", result.evaluations, score);
+            if(verbosity >= 2)
+            {
+                for(vec3 axis: axes)
+                    printf("    vec3(%f, %f, %f),\n", axis.x, axis.y, axis.z);
+            }
+        }
+        return score;
+    }
+
+    // Re-scores the best axes so far after the objective has changed. This
+    // may make the best score worse, so it's not recorded in the history.
+    // Returns true if the objective changed.
+    bool refresh(const axis_objective& objective)
+    {
+        if(!objective.refresh || !objective.refresh())
+            return false;
+        result.best_score = objective.cost(result.best_axes);
+        result.evaluations++;
+        result.seconds = elapsed();
+        if(verbosity >= 1)
+            printf("Objective changed, best axes re-scored to %e\n", result.best_score);
+        return true;
+    }
+
+    bool exhausted() const
+    {
+        return result.evaluations >= budget.max_evaluations ||
+            result.seconds >= budget.max_seconds;
+    }
+
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+    }
+
+private:
+    optimizer_result& result;
+    optimizer_budget budget;
+    int verbosity;
+    std::chrono::steady_clock::time_point start;
+};
+
+// The free axes may be all zeros when the caller has no starting point.
+inline bool initial_axes_valid(const std::vector<vec3>& axes, int locked_axes)
+{
+    for(size_t i = locked_axes; i < axes.size(); ++i)
+        if(length(axes[i]) < 0.5f) return false;
+    return true;
+}
+
+inline std::vector<vec3> perturb_axes(
+    const std::vector<vec3>& axes,
+    int locked_axes,
+    float step,
+    uint& seed
+){
+    std::vector<vec3> perturbed = axes;
+    for(size_t i = locked_axes; i < perturbed.size(); ++i)
+        perturbed[i] = normalize(perturbed[i] + step * sample_sphere(seed));
+    return perturbed;
+}
+
+struct annealing_params
+{
+    float initial_step = 1.0f;
+    // Optimization ends once the step size drops below this.
+    float min_step = 1e-5f;
+    // Step size is halved after this many consecutive tries without
+    // improvement.
+    int patience = 100;
+    uint seed = 0;
+    // 0 = silent, 1 = print scores, 2 = print scores and axes.
+    int verbosity = 0;
+};
+
+// This is the "slight variation" of simulated annealing described in the
+// README: randomly perturb the best axes so far, and shrink the step size if
+// there has been no improvement for a while. Axes before 'locked_axes' are
+// never modified. Valid initial axes are scored first, so the result is never
+// worse than them.
+inline optimizer_result optimize_annealing(
+    const std::vector<vec3>& initial_axes,
+    int locked_axes,
+    const axis_objective& objective,
+    const annealing_params& params,
+    const optimizer_budget& budget = {}
+){
+    optimizer_result result;
+    result.best_axes = initial_axes;
+    optimizer_tracker tracker(result, budget, params.verbosity);
+
+    if(initial_axes_valid(initial_axes, locked_axes))
+        tracker.evaluate(objective, initial_axes);
+
+    uint seed = params.seed;
+    float step = params.initial_step;
+    int no_improvement = 0;
+    while(step > params.min_step && !tracker.exhausted())
+    {
+        tracker.refresh(objective);
+        std::vector<vec3> axes = perturb_axes(
+            result.best_axes, locked_axes, step, seed
+        );
+        float prev_best = result.best_score;
+        float score = tracker.evaluate(objective, axes);
+
+        // optimize_metropolis() is the variant that also accepts worse axes.
+        if(score < prev_best) no_improvement = 0;
+        else if(++no_improvement > params.patience)
+        {
+            step *= 0.5f;
+            no_improvement = 0;
+            if(params.verbosity >= 1)
+                printf("Adjusted step size to %e\n", step);
+        }
+    }
+    return result;
+}
+
+struct metropolis_params
+{
+    float initial_step = 1.0f;
+    // Optimization ends once the step size drops below this.
+    float min_step = 1e-5f;
+    // Number of evaluations over which the target acceptance rate goes from
+    // 1 to near 0. Running longer just keeps the final target.
+    size_t schedule_length = 10000;
+    // How quickly the temperature and the acceptance estimate react to each
+    // evaluation.
+    float temperature_rate = 0.01f;
+    // How quickly the step size reacts to the improvement rate.
+    float step_rate = 0.1f;
+    uint seed = 0;
+    // 0 = silent, 1 = print scores, 2 = print scores and axes.
+    int verbosity = 0;
+};
+
+// Target acceptance rate at the given point of the schedule (0 to 1). This is
+// the "modified Lam" schedule: Lam and Delosme found that annealing makes the
+// most progress per evaluation when about 44% of proposals are accepted, so
+// the target quickly drops there from 1, stays for a while, and then decays
+// to quench the result. The quench ends at 80% of the schedule instead of at
+// the end, which leaves the rest for refining the quenched axes; on the
+// sphere benchmarks that reaches the same volumes in about two thirds of the
+// evaluations.
+inline float lam_target_acceptance(float progress)
+{
+    if(progress < 0.15f)
+        return 0.44f + 0.56f * pow(560.0f, -progress / 0.15f);
+    if(progress < 0.4f)
+        return 0.44f;
+    progress = std::min(progress, 0.8f);
+    return 0.44f * pow(440.0f, -(progress - 0.4f) / 0.4f);
+}
+
+// Simulated annealing with Metropolis acceptance. Instead of a fixed cooling
+// schedule, the temperature is steered with feedback so that the measured
+// acceptance rate follows lam_target_acceptance(). The step size follows the
+// 1/5 success rule: it grows when more than a fifth of proposals improve on
+// the current axes and shrinks otherwise, which keeps it matched to the
+// scale of the current phase. Axes before 'locked_axes' are never modified.
+// Like in optimize_annealing(), valid initial axes are scored first.
+inline optimizer_result optimize_metropolis(
+    const std::vector<vec3>& initial_axes,
+    int locked_axes,
+    const axis_objective& objective,
+    const metropolis_params& params,
+    const optimizer_budget& budget = {}
+){
+    optimizer_result result;
+    result.best_axes = initial_axes;
+    optimizer_tracker tracker(result, budget, params.verbosity);
+
+    uint seed = params.seed;
+    std::vector<vec3> current_axes = initial_axes;
+    // If there are no valid initial axes, the first proposal is always
+    // accepted.
+    float current_score = INFINITY;
+    if(initial_axes_valid(initial_axes, locked_axes))
+        current_score = tracker.evaluate(objective, initial_axes);
+    float step = params.initial_step;
+    float reported_step = step;
+    // Unknown until the first proposal that makes things worse.
+    float temperature = 0.0f;
+    float acceptance = 1.0f;
+
+    while(step > params.min_step && !tracker.exhausted())
+    {
+        if(tracker.refresh(objective) && current_score != INFINITY)
+            current_score = tracker.evaluate(objective, current_axes);
+
+        std::vector<vec3> axes = perturb_axes(
+            current_axes, locked_axes, step, seed
+        );
+        float score = tracker.evaluate(objective, axes);
+
+        float progress = float(result.evaluations) / params.schedule_length;
+        float target = lam_target_acceptance(progress);
+        float delta = score - current_score;
+        bool improved = score < current_score;
+
+        // Start at a temperature where this first worsening would have been
+        // accepted at the target rate; the feedback takes over from there.
+        if(!improved && temperature == 0.0f && delta > 0 && std::isfinite(delta))
+            temperature = delta / -log(target);
+
+        bool accepted = improved;
+        if(!improved && temperature > 0.0f)
+            accepted = generate_uniform_random(seed) < exp(-delta / temperature);
+        if(accepted)
+        {
+            current_axes = axes;
+            current_score = score;
+        }
+
+        acceptance += params.temperature_rate * (float(accepted) - acceptance);
+        if(acceptance > target)
+            temperature *= 1.0f - params.temperature_rate;
+        else
+            temperature /= 1.0f - params.temperature_rate;
+
+        step *= exp(params.step_rate * (float(improved) - 0.2f));
+        step = std::min(step, 2.0f);
+
+        if(params.verbosity >= 1 && step < reported_step * 0.5f)
+        {
+            reported_step = step;
+            printf(
+                "Adjusted step size to %e (temperature %e, acceptance %f)\n",
+                step, temperature, acceptance
+            );
+        }
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,354 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+#include <glm/glm.hpp>
+#include "kdop_volume.hh"
+#include "optimizer.hh"
+#include "bayesian_optimizer.hh"
+#include "image_cost.hh"
+#include "test_images.hh"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <climits>
+#include <clocale>
+
+using namespace glm;
+
+struct benchmark_problem
+{
+    std::string name;
+    int axis_count;
+    int locked_axes;
+    axis_cost_function cost;
+    // The same step size schedule that the corresponding tool uses.
+    annealing_params annealing;
+    optimizer_budget budget;
+    // Best known score, which time-to-target is measured against. It's fixed
+    // so that results stay comparable between versions of the optimizers.
+    float reference_score;
+};
+
+struct benchmark_mode
+{
+    const char* name;
+    std::function<optimizer_result(
+        const benchmark_problem& problem,
+        const std::vector<vec3>& initial_axes,
+        uint seed
+    )> run;
+    // Problems with more free axes are skipped.
+    int max_free_axes = INT_MAX;
+};
+
+bool mode_applies(const benchmark_mode& mode, const benchmark_problem& problem)
+{
+    return problem.axis_count - problem.locked_axes <= mode.max_free_axes;
+}
+
+std::vector<benchmark_mode> get_benchmark_modes()
+{
+    return {
+        {
+            "annealing",
+            [](const benchmark_problem& p, const std::vector<vec3>& axes, uint seed)
+            {
+                annealing_params params = p.annealing;
+                params.seed = seed;
+                return optimize_annealing(axes, p.locked_axes, p.cost, params, p.budget);
+            }
+        },
+        {
+            "metropolis",
+            [](const benchmark_problem& p, const std::vector<vec3>& axes, uint seed)
+            {
+                metropolis_params params;
+                params.initial_step = p.annealing.initial_step;
+                params.min_step = p.annealing.min_step;
+                params.schedule_length = p.budget.max_evaluations;
+                params.seed = seed;
+                return optimize_metropolis(axes, p.locked_axes, p.cost, params, p.budget);
+            }
+        },
+        {
+            "bayesian",
+            [](const benchmark_problem& p, const std::vector<vec3>& axes, uint seed)
+            {
+                bayesian_params params;
+                params.seed = seed;
+                return optimize_bayesian(axes, p.locked_axes, p.cost, params, p.budget);
+            },
+            bayesian_max_free_axes
+        }
+    };
+}
+
+void add_sphere_problem(
+    std::vector<benchmark_problem>& problems,
+    int axis_count,
+    int locked_axes,
+    float reference_score,
+    double budget_scale
+){
+    benchmark_problem p;
+    p.name = "sphere-" + std::to_string(axis_count);
+    if(locked_axes > 0) p.name += "-xyz";
+    p.axis_count = axis_count;
+    p.locked_axes = locked_axes;
+    p.reference_score = reference_score;
+    p.cost = [axis_count](const std::vector<vec3>& axes)
+    {
+        std::vector<vec2> extents(axis_count, vec2(-1, 1));
+        return float(calc_kdop_volume(axes.size(), axes.data(), extents.data()));
+    };
+    p.annealing.initial_step = 2;
+    p.annealing.min_step = 1e-5f;
+    p.annealing.patience = 1000;
+    p.budget.max_evaluations = size_t(20000 * budget_scale);
+    problems.push_back(std::move(p));
+}
+
+void add_image_problem(
+    std::vector<benchmark_problem>& problems,
+    test_image kind,
+    int axis_count,
+    int locked_axes,
+    float reference_score,
+    double budget_scale
+){
+    const int size = 256;
+    benchmark_problem p;
+    p.name = std::string("image-") + test_image_name(kind) + "-" +
+        std::to_string(axis_count);
+    if(locked_axes > 0) p.name += "-xyz";
+    p.axis_count = axis_count;
+    p.locked_axes = locked_axes;
+    p.reference_score = reference_score;
+    p.annealing.initial_step = 1;
+    p.annealing.min_step = FLT_MIN;
+    p.annealing.patience = 100;
+    p.budget.max_evaluations = size_t(500 * budget_scale);
+
+    std::vector<uint8_t> image = generate_test_image(kind, size, size, 1234 + int(kind));
+    auto dataset = std::make_shared<neighborhood_dataset>();
+    sample_neighborhoods(*dataset, size, size, image.data(), 0, 2000);
+    p.cost = [dataset](const std::vector<vec3>& axes)
+    {
+        return evaluate_axes_cost(*dataset, axes.data(), axes.size());
+    };
+    problems.push_back(std::move(p));
+}
+
+std::vector<vec3> initial_axes(int axis_count, int locked_axes, uint& seed)
+{
+    std::vector<vec3> axes(axis_count);
+    for(int i = 0; i < axis_count; ++i)
+        axes[i] = i < locked_axes && i < 3 ? vec3(i == 0, i == 1, i == 2) : sample_sphere(seed);
+    return axes;
+}
+
+struct benchmark_run
+{
+    const char* mode;
+    uint axis_seed;
+    uint run_seed;
+    optimizer_result result;
+};
+
+// Returns the first point in history where the score reached 'target', or
+// null if it never did.
+const optimizer_progress* find_time_to_target(
+    const optimizer_result& result,
+    float target
+){
+    for(const optimizer_progress& p: result.history)
+    {
+        if(p.best_score <= target)
+            return &p;
+    }
+    return nullptr;
+}
+
+double median(std::vector<double> values)
+{
+    if(values.size() == 0) return NAN;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : 0.5 * (values[mid-1] + values[mid]);
+}
+
+void write_number(FILE* f, double value)
+{
+    if(std::isfinite(value)) fprintf(f, "%.9g", value);
+    else fprintf(f, "null");
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printf("Usage: %s <output-json> [runs-per-problem] [budget-scale]\n", argv[0]);
+        return 1;
+    }
+
+    // Make atoi / atof behave predictably
+    setlocale(LC_ALL, "C");
+
+    const char* output_path = argv[1];
+    int run_count = argc > 2 ? atoi(argv[2]) : 3;
+    double budget_scale = argc > 3 ? atof(argv[3]) : 1.0;
+
+    // Relative distance from the best known score.
+    const double thresholds[] = {1e-1, 1e-2, 1e-3};
+
+    // Reference scores are the best ones found over all modes with long
+    // budgets. If a run beats one, it's reported so that it can be updated.
+    std::vector<benchmark_problem> problems;
+    add_sphere_problem(problems, 4, 0, 6.92820311f, budget_scale);
+    add_sphere_problem(problems, 8, 3, 5.21736193f, budget_scale);
+    add_sphere_problem(problems, 12, 3, 4.80519819f, budget_scale);
+    add_image_problem(problems, test_image::SHAPES, 4, 0, 1.02310348e-3f, budget_scale);
+    add_image_problem(problems, test_image::NOISE, 6, 3, 1.35511145e-4f, budget_scale);
+    add_image_problem(problems, test_image::STRIPES, 4, 0, 2.18547651e-8f, budget_scale);
+
+    std::vector<benchmark_mode> modes = get_benchmark_modes();
+
+    FILE* f = fopen(output_path, "w");
+    if(!f)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", output_path);
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"thresholds\": [");
+    for(size_t i = 0; i < std::size(thresholds); ++i)
+        fprintf(f, "%s%g", i ? ", " : "", thresholds[i]);
+    fprintf(f, "],\n  \"problems\": [\n");
+
+    for(size_t pi = 0; pi < problems.size(); ++pi)
+    {
+        const benchmark_problem& p = problems[pi];
+        std::vector<const benchmark_mode*> problem_modes;
+        for(const benchmark_mode& mode: modes)
+            if(mode_applies(mode, p)) problem_modes.push_back(&mode);
+
+        std::vector<benchmark_run> runs;
+        const float reference = p.reference_score;
+        float best_score = INFINITY;
+        for(const benchmark_mode* mode: problem_modes)
+        for(int r = 0; r < run_count; ++r)
+        {
+            // The run gets its own random stream, so that it doesn't replay
+            // the draws of the initial axes. Both seeds are recorded so that
+            // the run can be reproduced.
+            uint axis_seed = r + 1;
+            uint run_seed = axis_seed ^ 0x9E3779B9u;
+            uint seed = axis_seed;
+            std::vector<vec3> axes = initial_axes(p.axis_count, p.locked_axes, seed);
+            printf("%s: %s, run %d\n", p.name.c_str(), mode->name, r);
+            optimizer_result result = mode->run(p, axes, run_seed);
+            printf(
+                "    best %e after %zu evaluations, %f s\n",
+                result.best_score, result.evaluations, result.seconds
+            );
+            best_score = std::min(best_score, result.best_score);
+            runs.push_back({mode->name, axis_seed, run_seed, std::move(result)});
+        }
+
+        if(best_score < reference)
+            printf(
+                "%s: new best score %.9g, reference is %.9g\n",
+                p.name.c_str(), best_score, reference
+            );
+
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"name\": \"%s\",\n", p.name.c_str());
+        fprintf(f, "      \"axis_count\": %d,\n", p.axis_count);
+        fprintf(f, "      \"locked_axes\": %d,\n", p.locked_axes);
+        fprintf(f, "      \"reference_score\": ");
+        write_number(f, reference);
+        fprintf(f, ",\n      \"best_score\": ");
+        write_number(f, best_score);
+        fprintf(f, ",\n      \"runs\": [\n");
+        for(size_t ri = 0; ri < runs.size(); ++ri)
+        {
+            const benchmark_run& run = runs[ri];
+            const optimizer_result& res = run.result;
+            fprintf(
+                f, "        {\"mode\": \"%s\", \"axis_seed\": %u, \"run_seed\": %u, ",
+                run.mode, run.axis_seed, run.run_seed
+            );
+            fprintf(f, "\"best_score\": ");
+            write_number(f, res.best_score);
+            fprintf(f, ", \"evaluations\": %zu, \"seconds\": ", res.evaluations);
+            write_number(f, res.seconds);
+            fprintf(f, ",\n         \"time_to_target\": [");
+            for(size_t ti = 0; ti < std::size(thresholds); ++ti)
+            {
+                const optimizer_progress* hit = find_time_to_target(
+                    res, reference * (1.0 + thresholds[ti])
+                );
+                if(ti) fprintf(f, ", ");
+                if(hit) fprintf(f, "{\"evaluations\": %zu, \"seconds\": %.9g}", hit->evaluations, hit->seconds);
+                else fprintf(f, "null");
+            }
+            fprintf(f, "],\n         \"history\": [");
+            for(size_t hi = 0; hi < res.history.size(); ++hi)
+            {
+                const optimizer_progress& h = res.history[hi];
+                fprintf(f, "%s[%zu, %.9g, %.9g]", hi ? ", " : "", h.evaluations, h.seconds, h.best_score);
+            }
+            fprintf(f, "]}%s\n", ri + 1 < runs.size() ? "," : "");
+        }
+        fprintf(f, "      ],\n      \"summary\": [\n");
+        for(size_t mi = 0; mi < problem_modes.size(); ++mi)
+        {
+            const benchmark_mode& mode = *problem_modes[mi];
+            fprintf(f, "        {\"mode\": \"%s\", \"time_to_target\": [", mode.name);
+            for(size_t ti = 0; ti < std::size(thresholds); ++ti)
+            {
+                std::vector<double> evaluations, seconds;
+                for(const benchmark_run& run: runs)
+                {
+                    if(run.mode != mode.name) continue;
+                    const optimizer_progress* hit = find_time_to_target(
+                        run.result, reference * (1.0 + thresholds[ti])
+                    );
+                    if(!hit) continue;
+                    evaluations.push_back(hit->evaluations);
+                    seconds.push_back(hit->seconds);
+                }
+                fprintf(f, "%s{\"reached\": %zu, \"median_evaluations\": ", ti ? ", " : "", evaluations.size());
+                write_number(f, median(evaluations));
+                fprintf(f, ", \"median_seconds\": ");
+                write_number(f, median(seconds));
+                fprintf(f, "}");
+            }
+            fprintf(f, "]}%s\n", mi + 1 < problem_modes.size() ? "," : "");
+        }
+        fprintf(f, "      ]\n    }%s\n", pi + 1 < problems.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    printf("Wrote %s\n", output_path);
+    return 0;
+}
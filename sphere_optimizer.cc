@@ -15,12 +15,12 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 // DEALINGS IN THE SOFTWARE.
 #include <glm/glm.hpp>
-#include <glm/gtc/random.hpp>
 #include <vector>
 #include <cstdio>
 #include <cmath>
 #include <clocale>
 #include "kdop_volume.hh"
+#include "optimizer.hh"
 using namespace glm;
 
 // The k-DOP axes are slightly different in the paper with the same parameters,
@@ -76,7 +76,11 @@ int main(int argc, char** argv)
     setlocale(LC_ALL, "C");
 
     int axis_count = atoi(argv[1]);
-    float best_volume = 1e99;
+    if(axis_count < 3 || axis_count > int(kdop_max_axis_count))
+    {
+        fprintf(stderr, "Axis count must be between 3 and %zu\n", kdop_max_axis_count);
+        return 1;
+    }
     std::vector<vec3> best_axes(axis_count, vec3(0));
     std::vector<vec2> extents(axis_count, vec2(-1, 1));
     int locked_axes = 0;
@@ -90,36 +94,30 @@ int main(int argc, char** argv)
     for(int i = 0; i < locked_axes; ++i)
         best_axes[i] = normalize(best_axes[i]);
 
-    int no_improvement = 0;
-    float perturbation = 2;
-
-    for(int j = 0; perturbation > 1e-5; ++j)
-    {
-        std::vector<vec3> axes = best_axes;
-        for(int i = locked_axes; i < axis_count; ++i)
-            axes[i] = normalize(axes[i]+sphericalRand(perturbation));
-
-        float volume = calc_kdop_volume(axes.size(), axes.data(), extents.data());
-        //float volume = evaluate_volume(axes);
-
-        if(volume < best_volume)
+    annealing_params params;
+    params.initial_step = 2;
+    params.min_step = 1e-5f;
+    params.patience = 1000;
+    params.verbosity = 1;
+    // Proposals are perturbations of the same best axes, so late in the run,
+    // the previous proposal's topology almost always matches the next one.
+    // Early on, mismatches are detected quickly and just fall back to the full
+    // calculation.
+    kdop_topology topology;
+    optimizer_result result = optimize_annealing(
+        best_axes,
+        locked_axes,
+        [&](const std::vector<vec3>& axes)
         {
-            best_volume = volume;
-            best_axes = axes;
-            no_improvement = 0;
-            printf("Best so far on try %d: %f\n", j, volume);
-        }
-        else
-        {
-            no_improvement++;
-            if(no_improvement > 1000)
-            {
-                perturbation *= 0.5f;
-                no_improvement = 0;
-                printf("Adjusted perturbation to %f\n", perturbation);
-            }
-        }
-    }
+            return calc_kdop_volume(
+                axes.size(), axes.data(), extents.data(), &topology
+            );
+            //return evaluate_volume(axes);
+        },
+        params
+    );
+    best_axes = result.best_axes;
+    float best_volume = result.best_score;
 
     printf("Finished with best volume = %f\n", best_volume);
     for(int i = 0; i < axis_count; ++i)
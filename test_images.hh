@@ -0,0 +1,133 @@
+// Copyright 2024 Julius Ikkala
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef KDOP_TEST_IMAGES_HH
+#define KDOP_TEST_IMAGES_HH
+#include <glm/glm.hpp>
+#include "optimizer.hh"
+#include <vector>
+#include <cstdint>
+#include <cmath>
+using namespace glm;
+
+// Procedurally generated stand-ins for representative TAA input images. They
+// are deliberately aliased, as that is what the image optimizer is meant for.
+enum class test_image
+{
+    SHAPES,
+    NOISE,
+    STRIPES
+};
+
+inline const char* test_image_name(test_image kind)
+{
+    switch(kind)
+    {
+    case test_image::SHAPES: return "shapes";
+    case test_image::NOISE: return "noise";
+    case test_image::STRIPES: return "stripes";
+    }
+    return "unknown";
+}
+
+inline vec3 random_color(uint& seed)
+{
+    return vec3(
+        generate_uniform_random(seed),
+        generate_uniform_random(seed),
+        generate_uniform_random(seed)
+    );
+}
+
+inline std::vector<uint8_t> generate_test_image(test_image kind, int w, int h, uint seed)
+{
+    std::vector<vec3> pixels(w * h);
+    switch(kind)
+    {
+    case test_image::SHAPES:
+        {
+            vec3 top = random_color(seed);
+            vec3 bottom = random_color(seed);
+            for(int y = 0; y < h; ++y)
+            for(int x = 0; x < w; ++x)
+                pixels[x + y * w] = mix(top, bottom, vec3(float(y) / h));
+
+            for(int i = 0; i < 32; ++i)
+            {
+                vec3 color = random_color(seed);
+                vec2 center = vec2(
+                    generate_uniform_random(seed) * w,
+                    generate_uniform_random(seed) * h
+                );
+                float radius = (0.02f + generate_uniform_random(seed) * 0.15f) * w;
+                bool circle = generate_uniform_random(seed) < 0.5f;
+                for(int y = 0; y < h; ++y)
+                for(int x = 0; x < w; ++x)
+                {
+                    vec2 d = abs(vec2(x, y) - center);
+                    bool inside = circle ?
+                        dot(d, d) < radius * radius :
+                        d.x < radius && d.y < radius * 0.5f;
+                    if(inside) pixels[x + y * w] = color;
+                }
+            }
+        }
+        break;
+    case test_image::NOISE:
+        {
+            const int cell = 16;
+            int lw = w / cell + 2;
+            int lh = h / cell + 2;
+            std::vector<vec3> lattice(lw * lh);
+            for(vec3& c: lattice)
+                c = random_color(seed);
+            for(int y = 0; y < h; ++y)
+            for(int x = 0; x < w; ++x)
+            {
+                int lx = x / cell, ly = y / cell;
+                float fx = float(x % cell) / cell, fy = float(y % cell) / cell;
+                vec3 c0 = mix(lattice[lx + ly * lw], lattice[lx + 1 + ly * lw], vec3(fx));
+                vec3 c1 = mix(lattice[lx + (ly+1) * lw], lattice[lx + 1 + (ly+1) * lw], vec3(fx));
+                pixels[x + y * w] = mix(c0, c1, vec3(fy));
+            }
+        }
+        break;
+    case test_image::STRIPES:
+        {
+            vec3 a = random_color(seed);
+            vec3 b = random_color(seed);
+            float angle = generate_uniform_random(seed) * M_PI;
+            vec2 dir = vec2(cos(angle), sin(angle));
+            float period = 4.0f + generate_uniform_random(seed) * 12.0f;
+            for(int y = 0; y < h; ++y)
+            for(int x = 0; x < w; ++x)
+            {
+                float t = dot(vec2(x, y), dir) / period;
+                pixels[x + y * w] = t - floor(t) < 0.5f ? a : b;
+            }
+        }
+        break;
+    }
+
+    std::vector<uint8_t> data(w * h * 3);
+    for(size_t i = 0; i < pixels.size(); ++i)
+    for(int c = 0; c < 3; ++c)
+        data[i*3+c] = uint8_t(clamp(pixels[i][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+    return data;
+}
+
+#endif